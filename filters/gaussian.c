@@ -1,5 +1,6 @@
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/param.h>
 
 #define STB_IMAGE_IMPLEMENTATION
@@ -7,6 +8,78 @@
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "libs/stb/stb_image_write.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_SIMD
+#include <immintrin.h>
+
+// Kernels compiled for an instruction set, they are only called after
+// checking that the CPU supports it
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_AVX512 __attribute__((target("avx2,avx512f,avx512bw")))
+#endif
+
+// Kernels that must not be vectorized by the compiler
+#define TARGET_SCALAR __attribute__((optimize("no-tree-vectorize")))
+// Generic kernels, they are inlined in every instruction set variant
+#define INLINE_KERNEL static inline __attribute__((always_inline))
+
+// Window sizes with kernels specialized at compile time
+#define SPECIALIZED_SIZES 5
+#define MAX_SPECIALIZED_SIZE 11
+#define FOR_EACH_SPECIALIZED_SIZE(X, isa, target)                            \
+    X(isa, target, 3) X(isa, target, 5) X(isa, target, 7)                    \
+    X(isa, target, 9) X(isa, target, 11)
+
+// Fixed point gaussian kernels sum to 2^GAUSSIAN_FIXED_BITS
+#define GAUSSIAN_FIXED_BITS 14
+// Fractional bits kept between the passes of the fixed point filter
+#define GAUSSIAN_FIXED_EXTRA_BITS 7
+// Pixels filtered at once by the single precision row passes
+#define GAUSSIAN_FLOAT_BLOCK 16
+
+
+// Row passes of the separable gaussian filter
+typedef void (*gaussian_horizontal_row_t)(uint8_t* row, double* out,
+                                          int width, double* kernel,
+                                          int window_size);
+typedef void (*gaussian_vertical_row_t)(double** rows, uint8_t* out,
+                                        double* sums, int width,
+                                        double* kernel, int window_size);
+typedef void (*gaussian_horizontal_row_float_t)(uint8_t* row, float* out,
+                                                int width, float* kernel,
+                                                int window_size);
+typedef void (*gaussian_vertical_row_float_t)(float** rows, uint8_t* out,
+                                              float* sums, int width,
+                                              float* kernel,
+                                              int window_size);
+
+/**
+ * Instruction set variants of the kernels, selected at startup by
+ * select_kernels.
+ */
+typedef struct
+{
+    // Name of the instruction set
+    const char* isa;
+    void (*rgb2gray)(uint8_t* img, uint8_t* gray_ptr, int img_size);
+    gaussian_horizontal_row_t gaussian_horizontal_row;
+    gaussian_vertical_row_t gaussian_vertical_row;
+    gaussian_horizontal_row_float_t gaussian_horizontal_row_float;
+    gaussian_vertical_row_float_t gaussian_vertical_row_float;
+    void (*gaussian_fixed_horizontal)(uint8_t* img, int16_t* horizontal,
+                                      int width, int height,
+                                      uint16_t* kernel, int window_size);
+    void (*gaussian_fixed_vertical)(int16_t* horizontal, uint8_t* filtered,
+                                    int width, int height, uint16_t* kernel,
+                                    int window_size);
+    // Row passes specialized for windows of size 3, 5, 7, 9 and 11
+    gaussian_horizontal_row_t gaussian_horizontal_row_sized[SPECIALIZED_SIZES];
+    gaussian_vertical_row_t gaussian_vertical_row_sized[SPECIALIZED_SIZES];
+} filter_kernels_t;
+
+// Kernels used by the filters
+static filter_kernels_t kernels;
 
 /**
  * This function converts a RGB image to a gray image.
@@ -16,7 +89,7 @@
  *      uint8_t* gray_prt - pointer to store the image.
  *      int img_sime - size of the image.
  */
-void rgb2gray(uint8_t* img, uint8_t* gray_ptr, int img_size)
+INLINE_KERNEL void rgb2gray(uint8_t* img, uint8_t* gray_ptr, int img_size)
 {
     uint8_t* img_ptr = img;
 
@@ -31,35 +104,20 @@ void rgb2gray(uint8_t* img, uint8_t* gray_ptr, int img_size)
     }
 }
 
-/**
- * This function extracts a window of size x size from an image.
- *
- * Params:
- *      uint8_t* img - image.
- *      uint8_t* window - pointer to store the windows.
- *      int i - row in the image to extract the window (center of the
- *              window).
- *      int j - column in the image to extract the window (center of
- *              the window).
- *      int width - number of columns in the image.
- *      int size - size of the window.
- */
-void get_window(uint8_t* img, uint8_t* window, int i, int j, int width,
-                int size)
-{
-    // Get the middle of the window
-    int mid = (int) (size - 1)/2;
-
-    for (int m = -mid; m < mid + 1; m++)
-    {
-        for (int n = -mid; n < mid + 1; n++)
-        {
-            // Store the image pixel in the window
-            *window = *(img + i*width + m + j + n);
-            window++;
-        }
+// Instruction set variants of rgb2gray
+#define DEFINE_RGB2GRAY(isa, target)                                         \
+    target void rgb2gray_##isa(uint8_t* img, uint8_t* gray_ptr,              \
+                               int img_size)                                 \
+    {                                                                        \
+        rgb2gray(img, gray_ptr, img_size);                                   \
     }
-}
+
+DEFINE_RGB2GRAY(scalar, TARGET_SCALAR)
+#ifdef HAVE_X86_SIMD
+DEFINE_RGB2GRAY(sse2, TARGET_SSE2)
+DEFINE_RGB2GRAY(avx2, TARGET_AVX2)
+DEFINE_RGB2GRAY(avx512, TARGET_AVX512)
+#endif
 
 /**
  * This function returns a gaussian kernel of size x size and a
@@ -103,7 +161,44 @@ void get_gaussian_kernel(double* kernel, int size, double stdev)
 }
 
 /**
- * This function performs a gaussian filtering on an image.
+ * This function returns a 1D gaussian kernel of size elements and a
+ * standard deviation of stddev. The outer product of this kernel with
+ * itself is the kernel returned by get_gaussian_kernel.
+ *
+ * Params:
+ *      double* kernel - pointer to store the kernel.
+ *      int size - size of the kernel.
+ *      double stddev - standard deviation of the gaussian
+ *                      distribution.
+ */
+void get_gaussian_kernel_1d(double* kernel, int size, double stdev)
+{
+    // Get the middle of the window
+    double mid = (size - 1)/2.0;
+    double sum = 0;
+    int i;
+
+    for (i = 0; i < size; i++)
+    {
+        // Get x value
+        double x = i - mid;
+
+        // Evaluate in the gaussian distribution
+        kernel[i] = exp(-(x*x)/(2*stdev*stdev));
+        sum += kernel[i];
+    }
+
+    for (i = 0; i < size; i++)
+    {
+        // Normalize
+        kernel[i] /= sum;
+    }
+}
+
+/**
+ * This function performs a gaussian filtering on an image using the
+ * full 2D kernel. It is kept as the reference for the separable
+ * filter.
  *
  * Params:
  *      uint8_t* img - image to filter.
@@ -114,34 +209,37 @@ void get_gaussian_kernel(double* kernel, int size, double stdev)
  *      double stdev - standard deviation of the gaussian
  *                     distribution.
  */
-void gaussian_filter(uint8_t* img, uint8_t* filtered, int width, int height,
-                     int window_size, double stdev)
+void gaussian_filter_direct(uint8_t* img, uint8_t* filtered, int width,
+                            int height, int window_size, double stdev)
 {
     // Get the middle of the window
     int mid_window = (int) (window_size - 1)/2;
 
-    // Get memory for the windows
-    uint8_t* window = (uint8_t*) calloc(window_size*window_size, sizeof(uint8_t));
+    // Last row and column whose window is inside of the image
+    int last_row = height - window_size + mid_window;
+    int last_col = width - window_size + mid_window;
+
+    // Get memory for the kernel
     double* gaussian_kernel = (double*) calloc(window_size*window_size, sizeof(double));
 
     // Get the gaussian kernel
-    get_gaussian_kernel(gaussian_kernel, mid_window, stdev);
+    get_gaussian_kernel(gaussian_kernel, window_size, stdev);
 
-    for (int i = mid_window; i < height - mid_window; i++)
+    for (int i = mid_window; i <= last_row; i++)
     {
-        for (int j = mid_window; j < width - mid_window; j++)
+        for (int j = mid_window; j <= last_col; j++)
         {
             double sum = 0.0;
 
-            // Get the window from the image
-            get_window(img, window, i, j, width, window_size);
+            // The window is read in place from the image
+            uint8_t* window = img + (i - mid_window)*width + j - mid_window;
 
             // Compute the new value for the center pixel
             for (int u = 0; u < window_size; u++)
             {
                 for (int v = 0; v < window_size; v++)
                 {
-                    sum += gaussian_kernel[u*window_size + v]*((double) window[u*window_size + v]);
+                    sum += gaussian_kernel[u*window_size + v]*((double) window[u*width + v]);
                 }
             }
 
@@ -163,62 +261,1914 @@ void gaussian_filter(uint8_t* img, uint8_t* filtered, int width, int height,
     }
 
     // Free memory
-    free(window);
     free(gaussian_kernel);
 }
 
+/**
+ * This function performs the horizontal pass of the separable
+ * gaussian filter on one row. The taps are applied one at a time over
+ * the whole row, so the inner loop is contiguous and can be
+ * vectorized.
+ *
+ * Params:
+ *      uint8_t* row - row of the image to filter.
+ *      double* out - pointer to the horizontally filtered row.
+ *      int width - number of cols.
+ *      double* kernel - 1D kernel.
+ *      int window_size - size of the window.
+ */
+INLINE_KERNEL void gaussian_horizontal_row(uint8_t* row, double* out,
+                                           int width, double* kernel,
+                                           int window_size)
+{
+    // Get the middle of the window
+    int mid_window = (int) (window_size - 1)/2;
+
+    // Last column whose window is inside of the row
+    int last_col = width - window_size + mid_window;
 
-int main(int argc, char* argv[])
+    for (int j = mid_window; j <= last_col; j++)
+    {
+        out[j] = 0.0;
+    }
+
+    for (int v = 0; v < window_size; v++)
+    {
+        uint8_t* tap = row + v - mid_window;
+
+        for (int j = mid_window; j <= last_col; j++)
+        {
+            out[j] += kernel[v]*((double) tap[j]);
+        }
+    }
+}
+
+/**
+ * This function performs the vertical pass of the separable gaussian
+ * filter for one output row. The taps are applied one row at a time,
+ * so the inner loop is contiguous and can be vectorized.
+ *
+ * Params:
+ *      double** rows - horizontally filtered rows covered by the
+ *                      window, from top to bottom.
+ *      uint8_t* out - pointer to the filtered row.
+ *      double* sums - pointer to store the sums of the row.
+ *      int width - number of cols.
+ *      double* kernel - 1D kernel.
+ *      int window_size - size of the window.
+ */
+INLINE_KERNEL void gaussian_vertical_row(double** rows, uint8_t* out,
+                                         double* sums, int width,
+                                         double* kernel, int window_size)
 {
-    if (argc < 4)
+    // Get the middle of the window
+    int mid_window = (int) (window_size - 1)/2;
+
+    // Last column whose window is inside of the row
+    int last_col = width - window_size + mid_window;
+
+    for (int j = mid_window; j <= last_col; j++)
     {
-        printf("Args were not provided. `make nlm w=3 sigma=1.5 imgs=\"img1 img2 img3 etc\"`.\n");
+        sums[j] = 0.0;
     }
-    else
+
+    for (int u = 0; u < window_size; u++)
     {
-        // Convert to numbers
-        int win_size = atoi(argv[1]);
-        float sigma = atof(argv[2]);
+        double* tap = rows[u];
 
-        // Apply the filter to all images
-        for (int i = 3; i < argc; i++)
+        for (int j = mid_window; j <= last_col; j++)
         {
-            int width, height, channels;
+            sums[j] += kernel[u]*tap[j];
+        }
+    }
 
-            // Load image
-            uint8_t* rgb_img = stbi_load(argv[i], &width, &height, &channels, 3);
+    for (int j = mid_window; j <= last_col; j++)
+    {
+        uint8_t value = 0;
 
-            if (rgb_img == NULL)
-            {
-                printf("Error loading the image in %s.\n", argv[i]);
-                continue;
-            }
+        // Keep the pixel value between 0 and 255, avoiding
+        // unexpected values
+        if (sums[j] > 255)
+        {
+            value = 255;
+        } else if (sums[j] > 0)
+        {
+            value = (uint8_t) round(sums[j]);
+        }
 
-            // Convert image to gray
-            size_t img_size = width * height * channels;
-            size_t gray_img_size = width * height;
+        // Set the pixel
+        out[j] = value;
+    }
+}
 
-            uint8_t* gray_img = (uint8_t*) calloc(gray_img_size, sizeof(uint8_t));
+/**
+ * This function performs the horizontal pass of the separable gaussian
+ * filter on one row in single precision, like gaussian_horizontal_row.
+ * A vector holds twice as many floats as doubles.
+ *
+ * Params:
+ *      uint8_t* row - row of the image to filter.
+ *      float* out - pointer to the horizontally filtered row.
+ *      int width - number of cols.
+ *      float* kernel - 1D kernel.
+ *      int window_size - size of the window.
+ */
+INLINE_KERNEL void gaussian_horizontal_row_float(uint8_t* row, float* out,
+                                                 int width, float* kernel,
+                                                 int window_size)
+{
+    // Get the middle of the window
+    int mid_window = (int) (window_size - 1)/2;
+    int j = mid_window;
 
-            if (gray_img == NULL)
+    // Last column whose window is inside of the row
+    int last_col = width - window_size + mid_window;
+
+    // Blocks of GAUSSIAN_FLOAT_BLOCK pixels kept in registers for all
+    // the taps
+    for (; j + GAUSSIAN_FLOAT_BLOCK <= last_col + 1; j += GAUSSIAN_FLOAT_BLOCK)
+    {
+        float block[GAUSSIAN_FLOAT_BLOCK] = {0.0f};
+
+        for (int v = 0; v < window_size; v++)
+        {
+            uint8_t* tap = row + j + v - mid_window;
+
+            for (int k = 0; k < GAUSSIAN_FLOAT_BLOCK; k++)
             {
-                printf("Unable to allocate memory for the gray image.\n");
-                exit(1);
+                block[k] += kernel[v]*((float) tap[k]);
             }
+        }
+
+        for (int k = 0; k < GAUSSIAN_FLOAT_BLOCK; k++)
+        {
+            out[j + k] = block[k];
+        }
+    }
 
-            rgb2gray(rgb_img, gray_img, img_size);
+    for (; j <= last_col; j++)
+    {
+        float sum = 0.0f;
 
-            // Allocate memory for the filtered image
-            uint8_t* filtered_img = (uint8_t*) calloc(gray_img_size, sizeof(uint8_t));
+        for (int v = 0; v < window_size; v++)
+        {
+            sum += kernel[v]*((float) row[j + v - mid_window]);
+        }
 
-            if (filtered_img == NULL)
+        out[j] = sum;
+    }
+}
+
+/**
+ * This function performs the vertical pass of the separable gaussian
+ * filter for one output row in single precision, like
+ * gaussian_vertical_row.
+ *
+ * Params:
+ *      float** rows - horizontally filtered rows covered by the window,
+ *                     from top to bottom.
+ *      uint8_t* out - pointer to the filtered row.
+ *      float* sums - pointer to store the sums of the row.
+ *      int width - number of cols.
+ *      float* kernel - 1D kernel.
+ *      int window_size - size of the window.
+ */
+INLINE_KERNEL void gaussian_vertical_row_float(float** rows, uint8_t* out,
+                                               float* sums, int width,
+                                               float* kernel,
+                                               int window_size)
+{
+    // Get the middle of the window
+    int mid_window = (int) (window_size - 1)/2;
+    int j = mid_window;
+
+    // Last column whose window is inside of the row
+    int last_col = width - window_size + mid_window;
+
+    // Blocks of GAUSSIAN_FLOAT_BLOCK pixels kept in registers for all
+    // the taps
+    for (; j + GAUSSIAN_FLOAT_BLOCK <= last_col + 1; j += GAUSSIAN_FLOAT_BLOCK)
+    {
+        float block[GAUSSIAN_FLOAT_BLOCK] = {0.0f};
+
+        for (int u = 0; u < window_size; u++)
+        {
+            float* tap = rows[u] + j;
+
+            for (int k = 0; k < GAUSSIAN_FLOAT_BLOCK; k++)
             {
-                printf("Unable to allocate memory for the filtered image.\n");
-                exit(1);
+                block[k] += kernel[u]*tap[k];
             }
+        }
 
-            // Gaussian filtering
-            gaussian_filter(gray_img, filtered_img, width, height, win_size, sigma);
+        for (int k = 0; k < GAUSSIAN_FLOAT_BLOCK; k++)
+        {
+            sums[j + k] = block[k];
+        }
+    }
+
+    for (; j <= last_col; j++)
+    {
+        float sum = 0.0f;
+
+        for (int u = 0; u < window_size; u++)
+        {
+            sum += kernel[u]*rows[u][j];
+        }
+
+        sums[j] = sum;
+    }
+
+    for (int j = mid_window; j <= last_col; j++)
+    {
+        uint8_t value = 0;
+
+        // Keep the pixel value between 0 and 255, avoiding
+        // unexpected values
+        if (sums[j] > 255)
+        {
+            value = 255;
+        } else if (sums[j] > 0)
+        {
+            value = (uint8_t) roundf(sums[j]);
+        }
+
+        // Set the pixel
+        out[j] = value;
+    }
+}
+
+/**
+ * This function performs the horizontal pass of the separable
+ * gaussian filter on one row for a window size known at compile time.
+ * The taps are fully unrolled and each pixel is kept in a register,
+ * the order of the sums is the same as in gaussian_horizontal_row.
+ *
+ * Params:
+ *      uint8_t* row - row of the image to filter.
+ *      double* out - pointer to the horizontally filtered row.
+ *      int width - number of cols.
+ *      double* kernel - 1D kernel.
+ *      const int window_size - size of the window, a constant.
+ */
+INLINE_KERNEL void gaussian_horizontal_row_unrolled(uint8_t* row,
+                                                    double* out, int width,
+                                                    double* kernel,
+                                                    const int window_size)
+{
+    // Get the middle of the window
+    const int mid_window = (window_size - 1)/2;
+
+    // Last column whose window is inside of the row
+    int last_col = width - window_size + mid_window;
+
+    for (int j = mid_window; j <= last_col; j++)
+    {
+        double sum = 0.0;
+
+        #pragma GCC unroll 16
+        for (int v = 0; v < window_size; v++)
+        {
+            sum += kernel[v]*((double) row[j - mid_window + v]);
+        }
+
+        out[j] = sum;
+    }
+}
+
+/**
+ * This function performs the vertical pass of the separable gaussian
+ * filter for one output row and a window size known at compile time.
+ * The taps are fully unrolled and each pixel is kept in a register,
+ * the order of the sums is the same as in gaussian_vertical_row.
+ *
+ * Params:
+ *      double** rows - horizontally filtered rows covered by the
+ *                      window, from top to bottom.
+ *      uint8_t* out - pointer to the filtered row.
+ *      int width - number of cols.
+ *      double* kernel - 1D kernel.
+ *      const int window_size - size of the window, a constant up to
+ *                              MAX_SPECIALIZED_SIZE.
+ */
+INLINE_KERNEL void gaussian_vertical_row_unrolled(double** rows,
+                                                  uint8_t* out, int width,
+                                                  double* kernel,
+                                                  const int window_size)
+{
+    // Get the middle of the window
+    const int mid_window = (window_size - 1)/2;
+
+    // Last column whose window is inside of the row
+    int last_col = width - window_size + mid_window;
+
+    // Local copy of the row pointers, the stores to the output can not
+    // modify them
+    double* taps[MAX_SPECIALIZED_SIZE];
+
+    #pragma GCC unroll 16
+    for (int u = 0; u < window_size; u++)
+    {
+        taps[u] = rows[u];
+    }
+
+    for (int j = mid_window; j <= last_col; j++)
+    {
+        double sum = 0.0;
+
+        #pragma GCC unroll 16
+        for (int u = 0; u < window_size; u++)
+        {
+            sum += kernel[u]*taps[u][j];
+        }
+
+        uint8_t value = 0;
+
+        // Keep the pixel value between 0 and 255, avoiding
+        // unexpected values
+        if (sum > 255)
+        {
+            value = 255;
+        } else if (sum > 0)
+        {
+            value = (uint8_t) round(sum);
+        }
+
+        // Set the pixel
+        out[j] = value;
+    }
+}
+
+// Row passes specialized for windows of size x size, they fall back to
+// the generic passes for other sizes
+#define DEFINE_GAUSSIAN_ROWS_SIZED(isa, target, size)                        \
+    target void gaussian_horizontal_row_##isa##_##size(uint8_t* row,         \
+                                                      double* out,           \
+                                                      int width,             \
+                                                      double* kernel,        \
+                                                      int window_size)       \
+    {                                                                        \
+        if (window_size != size)                                             \
+        {                                                                    \
+            gaussian_horizontal_row_##isa(row, out, width, kernel,           \
+                                          window_size);                      \
+            return;                                                          \
+        }                                                                    \
+                                                                             \
+        gaussian_horizontal_row_unrolled(row, out, width, kernel, size);     \
+    }                                                                        \
+                                                                             \
+    target void gaussian_vertical_row_##isa##_##size(double** rows,          \
+                                                    uint8_t* out,            \
+                                                    double* sums,            \
+                                                    int width,               \
+                                                    double* kernel,          \
+                                                    int window_size)         \
+    {                                                                        \
+        if (window_size != size)                                             \
+        {                                                                    \
+            gaussian_vertical_row_##isa(rows, out, sums, width, kernel,      \
+                                        window_size);                        \
+            return;                                                          \
+        }                                                                    \
+                                                                             \
+        gaussian_vertical_row_unrolled(rows, out, width, kernel, size);      \
+    }
+
+// Instruction set variants of the row passes
+#define DEFINE_GAUSSIAN_ROWS(isa, target)                                    \
+    target void gaussian_horizontal_row_##isa(uint8_t* row, double* out,     \
+                                              int width, double* kernel,     \
+                                              int window_size)               \
+    {                                                                        \
+        gaussian_horizontal_row(row, out, width, kernel, window_size);       \
+    }                                                                        \
+                                                                             \
+    target void gaussian_vertical_row_##isa(double** rows, uint8_t* out,     \
+                                            double* sums, int width,         \
+                                            double* kernel,                  \
+                                            int window_size)                 \
+    {                                                                        \
+        gaussian_vertical_row(rows, out, sums, width, kernel,                \
+                              window_size);                                  \
+    }                                                                        \
+                                                                             \
+    target void gaussian_horizontal_row_float_##isa(uint8_t* row,            \
+                                                    float* out, int width,   \
+                                                    float* kernel,           \
+                                                    int window_size)         \
+    {                                                                        \
+        gaussian_horizontal_row_float(row, out, width, kernel,               \
+                                      window_size);                          \
+    }                                                                        \
+                                                                             \
+    target void gaussian_vertical_row_float_##isa(float** rows,              \
+                                                  uint8_t* out,              \
+                                                  float* sums, int width,    \
+                                                  float* kernel,             \
+                                                  int window_size)           \
+    {                                                                        \
+        gaussian_vertical_row_float(rows, out, sums, width, kernel,          \
+                                    window_size);                            \
+    }                                                                        \
+                                                                             \
+    FOR_EACH_SPECIALIZED_SIZE(DEFINE_GAUSSIAN_ROWS_SIZED, isa, target)
+
+DEFINE_GAUSSIAN_ROWS(scalar, TARGET_SCALAR)
+#ifdef HAVE_X86_SIMD
+DEFINE_GAUSSIAN_ROWS(sse2, TARGET_SSE2)
+DEFINE_GAUSSIAN_ROWS(avx2, TARGET_AVX2)
+DEFINE_GAUSSIAN_ROWS(avx512, TARGET_AVX512)
+#endif
+
+/**
+ * This function performs a gaussian filtering on an image. The 2D
+ * kernel is separable, so the image is filtered with a horizontal 1D
+ * pass followed by a vertical 1D pass, which costs 2*window_size
+ * operations per pixel instead of window_size*window_size.
+ *
+ * The image is streamed one row at a time: only the window_size
+ * horizontally filtered rows covered by the window are kept, in a ring
+ * buffer, and the vertical pass reads them through row pointers.
+ *
+ * Params:
+ *      uint8_t* img - image to filter.
+ *      uint8_t* filtered - pointer to the filtered image.
+ *      int width - number of cols.
+ *      int height - number of rows.
+ *      int window_size - size of the window.
+ *      double stdev - standard deviation of the gaussian
+ *                     distribution.
+ */
+void gaussian_filter(uint8_t* img, uint8_t* filtered, int width, int height,
+                     int window_size, double stdev)
+{
+    // Get the middle of the window
+    int mid_window = (int) (window_size - 1)/2;
+
+    // Last row whose window is inside of the image
+    int last_row = height - window_size + mid_window;
+
+    // Get memory for the kernel, the rows in flight and the sums of a
+    // row
+    double* gaussian_kernel = (double*) calloc(window_size, sizeof(double));
+    double* ring = (double*) calloc(window_size*width, sizeof(double));
+    double** rows = (double**) calloc(window_size, sizeof(double*));
+    double* sums = (double*) calloc(width, sizeof(double));
+
+    if (gaussian_kernel == NULL || ring == NULL || rows == NULL || sums == NULL)
+    {
+        printf("Unable to allocate memory for the separable filter.\n");
+        exit(1);
+    }
+
+    // Get the gaussian kernel
+    get_gaussian_kernel_1d(gaussian_kernel, window_size, stdev);
+
+    // Horizontal pass of the rows above the first output row
+    for (int i = 0; i < MIN(window_size - 1, height); i++)
+    {
+        kernels.gaussian_horizontal_row(img + i*width, ring + i*width, width, gaussian_kernel, window_size);
+    }
+
+    for (int i = mid_window; i <= last_row; i++)
+    {
+        // Horizontal pass of the row entering the window, it takes the
+        // place of the row that left it
+        int entering = i - mid_window + window_size - 1;
+
+        if (entering < height)
+        {
+            kernels.gaussian_horizontal_row(img + entering*width, ring + (entering % window_size)*width, width, gaussian_kernel, window_size);
+        }
+
+        // Rows covered by the window, from top to bottom
+        for (int u = 0; u < window_size; u++)
+        {
+            rows[u] = ring + ((i - mid_window + u) % window_size)*width;
+        }
+
+        // Vertical pass
+        kernels.gaussian_vertical_row(rows, filtered + i*width, sums, width, gaussian_kernel, window_size);
+    }
+
+    // Free memory
+    free(gaussian_kernel);
+    free(ring);
+    free(rows);
+    free(sums);
+}
+
+/**
+ * This function performs a gaussian filtering on an image like
+ * gaussian_filter, but the kernel, the rows in flight and the sums are
+ * kept in single precision. The vectors hold twice as many values and
+ * the rows in flight take half of the memory, the result only needs to
+ * be right to 8 bits.
+ *
+ * Params:
+ *      uint8_t* img - image to filter.
+ *      uint8_t* filtered - pointer to the filtered image.
+ *      int width - number of cols.
+ *      int height - number of rows.
+ *      int window_size - size of the window.
+ *      double stdev - standard deviation of the gaussian
+ *                     distribution.
+ */
+void gaussian_filter_float(uint8_t* img, uint8_t* filtered, int width,
+                           int height, int window_size, double stdev)
+{
+    // Get the middle of the window
+    int mid_window = (int) (window_size - 1)/2;
+
+    // Last row whose window is inside of the image
+    int last_row = height - window_size + mid_window;
+
+    // Get memory for the kernels, the rows in flight and the sums of a
+    // row
+    double* real_kernel = (double*) calloc(window_size, sizeof(double));
+    float* gaussian_kernel = (float*) calloc(window_size, sizeof(float));
+    float* ring = (float*) calloc(window_size*width, sizeof(float));
+    float** rows = (float**) calloc(window_size, sizeof(float*));
+    float* sums = (float*) calloc(width, sizeof(float));
+
+    if (real_kernel == NULL || gaussian_kernel == NULL || ring == NULL ||
+        rows == NULL || sums == NULL)
+    {
+        printf("Unable to allocate memory for the separable filter.\n");
+        exit(1);
+    }
+
+    // Get the gaussian kernel
+    get_gaussian_kernel_1d(real_kernel, window_size, stdev);
+
+    for (int v = 0; v < window_size; v++)
+    {
+        gaussian_kernel[v] = (float) real_kernel[v];
+    }
+
+    // Horizontal pass of the rows above the first output row
+    for (int i = 0; i < MIN(window_size - 1, height); i++)
+    {
+        kernels.gaussian_horizontal_row_float(img + i*width, ring + i*width, width, gaussian_kernel, window_size);
+    }
+
+    for (int i = mid_window; i <= last_row; i++)
+    {
+        // Horizontal pass of the row entering the window, it takes the
+        // place of the row that left it
+        int entering = i - mid_window + window_size - 1;
+
+        if (entering < height)
+        {
+            kernels.gaussian_horizontal_row_float(img + entering*width, ring + (entering % window_size)*width, width, gaussian_kernel, window_size);
+        }
+
+        // Rows covered by the window, from top to bottom
+        for (int u = 0; u < window_size; u++)
+        {
+            rows[u] = ring + ((i - mid_window + u) % window_size)*width;
+        }
+
+        // Vertical pass
+        kernels.gaussian_vertical_row_float(rows, filtered + i*width, sums, width, gaussian_kernel, window_size);
+    }
+
+    // Free memory
+    free(real_kernel);
+    free(gaussian_kernel);
+    free(ring);
+    free(rows);
+    free(sums);
+}
+
+/**
+ * This function returns a 1D gaussian kernel of size elements and a
+ * standard deviation of stddev quantized to fixed point. The weights
+ * sum to 2^GAUSSIAN_FIXED_BITS, so they also fit in an int16_t.
+ *
+ * Params:
+ *      uint16_t* kernel - pointer to store the kernel.
+ *      int size - size of the kernel.
+ *      double stddev - standard deviation of the gaussian
+ *                      distribution.
+ */
+void get_gaussian_kernel_fixed(uint16_t* kernel, int size, double stdev)
+{
+    double* real_kernel = (double*) calloc(size, sizeof(double));
+    int sum = 0;
+
+    if (real_kernel == NULL)
+    {
+        printf("Unable to allocate memory for the kernel.\n");
+        exit(1);
+    }
+
+    // Get the gaussian kernel
+    get_gaussian_kernel_1d(real_kernel, size, stdev);
+
+    for (int i = 0; i < size; i++)
+    {
+        // Quantize
+        kernel[i] = (uint16_t) round(real_kernel[i]*(1 << GAUSSIAN_FIXED_BITS));
+        sum += kernel[i];
+    }
+
+    // The rounding error goes to the center, which is the biggest
+    // weight, so the sum is exactly a power of two
+    kernel[size/2] += (1 << GAUSSIAN_FIXED_BITS) - sum;
+
+    // Free memory
+    free(real_kernel);
+}
+
+/**
+ * This function performs the horizontal pass of the fixed point
+ * gaussian filter. The result keeps GAUSSIAN_FIXED_EXTRA_BITS
+ * fractional bits.
+ *
+ * Params:
+ *      uint8_t* img - image to filter.
+ *      int16_t* horizontal - pointer to the horizontally filtered
+ *                            image.
+ *      int width - number of cols.
+ *      int height - number of rows.
+ *      uint16_t* kernel - fixed point 1D kernel.
+ *      int window_size - size of the window.
+ */
+TARGET_SCALAR void gaussian_fixed_horizontal_scalar(uint8_t* img,
+                                                    int16_t* horizontal,
+                                                    int width, int height,
+                                                    uint16_t* kernel,
+                                                    int window_size)
+{
+    // Get the middle of the window
+    int mid_window = (int) (window_size - 1)/2;
+    int shift = GAUSSIAN_FIXED_BITS - GAUSSIAN_FIXED_EXTRA_BITS;
+
+    // Last column whose window is inside of the row
+    int last_col = width - window_size + mid_window;
+
+    for (int i = 0; i < height; i++)
+    {
+        uint8_t* row = img + i*width - mid_window;
+        int16_t* out = horizontal + i*width;
+
+        for (int j = mid_window; j <= last_col; j++)
+        {
+            int32_t sum = 0;
+
+            for (int v = 0; v < window_size; v++)
+            {
+                sum += kernel[v]*row[j + v];
+            }
+
+            out[j] = (int16_t) ((sum + (1 << (shift - 1))) >> shift);
+        }
+    }
+}
+
+/**
+ * This function performs the vertical pass of the fixed point
+ * gaussian filter and drops the fractional bits.
+ *
+ * Params:
+ *      int16_t* horizontal - horizontally filtered image.
+ *      uint8_t* filtered - pointer to the filtered image.
+ *      int width - number of cols.
+ *      int height - number of rows.
+ *      uint16_t* kernel - fixed point 1D kernel.
+ *      int window_size - size of the window.
+ */
+TARGET_SCALAR void gaussian_fixed_vertical_scalar(int16_t* horizontal,
+                                                  uint8_t* filtered, int width,
+                                                  int height, uint16_t* kernel,
+                                                  int window_size)
+{
+    // Get the middle of the window
+    int mid_window = (int) (window_size - 1)/2;
+    int shift = GAUSSIAN_FIXED_BITS + GAUSSIAN_FIXED_EXTRA_BITS;
+
+    // Last row and column whose window is inside of the image
+    int last_row = height - window_size + mid_window;
+    int last_col = width - window_size + mid_window;
+
+    for (int i = mid_window; i <= last_row; i++)
+    {
+        int16_t* col = horizontal + (i - mid_window)*width;
+
+        for (int j = mid_window; j <= last_col; j++)
+        {
+            int32_t sum = 0;
+
+            for (int u = 0; u < window_size; u++)
+            {
+                sum += kernel[u]*col[u*width + j];
+            }
+
+            sum = (sum + (1 << (shift - 1))) >> shift;
+
+            // Saturate
+            filtered[i*width + j] = (uint8_t) MIN(MAX(sum, 0), 255);
+        }
+    }
+}
+
+#ifdef HAVE_X86_SIMD
+/**
+ * SSE2 version of gaussian_fixed_horizontal_scalar. Eight pixels are
+ * computed at once, every pmaddwd applies two taps of the kernel.
+ */
+TARGET_SSE2 void gaussian_fixed_horizontal_sse2(uint8_t* img,
+                                                int16_t* horizontal, int width,
+                                                int height, uint16_t* kernel,
+                                                int window_size)
+{
+    // Get the middle of the window
+    int mid_window = (int) (window_size - 1)/2;
+    int shift = GAUSSIAN_FIXED_BITS - GAUSSIAN_FIXED_EXTRA_BITS;
+    __m128i zero = _mm_setzero_si128();
+    __m128i rounding = _mm_set1_epi32(1 << (shift - 1));
+
+    // Last column whose window is inside of the row
+    int last_col = width - window_size + mid_window;
+
+    for (int i = 0; i < height; i++)
+    {
+        uint8_t* row = img + i*width - mid_window;
+        int16_t* out = horizontal + i*width;
+        int j = mid_window;
+
+        for (; j + 8 <= last_col + 1; j += 8)
+        {
+            __m128i sum_lo = rounding;
+            __m128i sum_hi = rounding;
+
+            for (int v = 0; v < window_size; v += 2)
+            {
+                // Pair of taps, the last one is paired with zero
+                __m128i a = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i*) (row + j + v)), zero);
+                __m128i b = zero;
+                int weights = kernel[v];
+
+                if (v + 1 < window_size)
+                {
+                    b = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i*) (row + j + v + 1)), zero);
+                    weights |= kernel[v + 1] << 16;
+                }
+
+                __m128i w = _mm_set1_epi32(weights);
+
+                sum_lo = _mm_add_epi32(sum_lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), w));
+                sum_hi = _mm_add_epi32(sum_hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), w));
+            }
+
+            sum_lo = _mm_srai_epi32(sum_lo, shift);
+            sum_hi = _mm_srai_epi32(sum_hi, shift);
+            _mm_storeu_si128((__m128i*) (out + j), _mm_packs_epi32(sum_lo, sum_hi));
+        }
+
+        // Remaining pixels
+        for (; j <= last_col; j++)
+        {
+            int32_t sum = 0;
+
+            for (int v = 0; v < window_size; v++)
+            {
+                sum += kernel[v]*row[j + v];
+            }
+
+            out[j] = (int16_t) ((sum + (1 << (shift - 1))) >> shift);
+        }
+    }
+}
+
+/**
+ * SSE2 version of gaussian_fixed_vertical_scalar. Eight pixels are
+ * computed at once, every pmaddwd applies two taps of the kernel.
+ */
+TARGET_SSE2 void gaussian_fixed_vertical_sse2(int16_t* horizontal,
+                                              uint8_t* filtered, int width,
+                                              int height, uint16_t* kernel,
+                                              int window_size)
+{
+    // Get the middle of the window
+    int mid_window = (int) (window_size - 1)/2;
+    int shift = GAUSSIAN_FIXED_BITS + GAUSSIAN_FIXED_EXTRA_BITS;
+    __m128i zero = _mm_setzero_si128();
+    __m128i rounding = _mm_set1_epi32(1 << (shift - 1));
+
+    // Last row and column whose window is inside of the image
+    int last_row = height - window_size + mid_window;
+    int last_col = width - window_size + mid_window;
+
+    for (int i = mid_window; i <= last_row; i++)
+    {
+        int16_t* col = horizontal + (i - mid_window)*width;
+        uint8_t* out = filtered + i*width;
+        int j = mid_window;
+
+        for (; j + 8 <= last_col + 1; j += 8)
+        {
+            __m128i sum_lo = rounding;
+            __m128i sum_hi = rounding;
+
+            for (int u = 0; u < window_size; u += 2)
+            {
+                // Pair of taps, the last one is paired with zero
+                __m128i a = _mm_loadu_si128((__m128i*) (col + u*width + j));
+                __m128i b = zero;
+                int weights = kernel[u];
+
+                if (u + 1 < window_size)
+                {
+                    b = _mm_loadu_si128((__m128i*) (col + (u + 1)*width + j));
+                    weights |= kernel[u + 1] << 16;
+                }
+
+                __m128i w = _mm_set1_epi32(weights);
+
+                sum_lo = _mm_add_epi32(sum_lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), w));
+                sum_hi = _mm_add_epi32(sum_hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), w));
+            }
+
+            // Shift and saturate to 8 bits
+            sum_lo = _mm_srai_epi32(sum_lo, shift);
+            sum_hi = _mm_srai_epi32(sum_hi, shift);
+            __m128i value = _mm_packs_epi32(sum_lo, sum_hi);
+            _mm_storel_epi64((__m128i*) (out + j), _mm_packus_epi16(value, value));
+        }
+
+        // Remaining pixels
+        for (; j <= last_col; j++)
+        {
+            int32_t sum = 0;
+
+            for (int u = 0; u < window_size; u++)
+            {
+                sum += kernel[u]*col[u*width + j];
+            }
+
+            sum = (sum + (1 << (shift - 1))) >> shift;
+            out[j] = (uint8_t) MIN(MAX(sum, 0), 255);
+        }
+    }
+}
+
+/**
+ * AVX2 version of gaussian_fixed_horizontal_scalar. Sixteen pixels
+ * are computed at once, every vpmaddwd applies two taps of the kernel.
+ */
+TARGET_AVX2 void gaussian_fixed_horizontal_avx2(uint8_t* img,
+                                                int16_t* horizontal, int width,
+                                                int height, uint16_t* kernel,
+                                                int window_size)
+{
+    // Get the middle of the window
+    int mid_window = (int) (window_size - 1)/2;
+    int shift = GAUSSIAN_FIXED_BITS - GAUSSIAN_FIXED_EXTRA_BITS;
+    __m256i zero = _mm256_setzero_si256();
+    __m256i rounding = _mm256_set1_epi32(1 << (shift - 1));
+
+    // Last column whose window is inside of the row
+    int last_col = width - window_size + mid_window;
+
+    for (int i = 0; i < height; i++)
+    {
+        uint8_t* row = img + i*width - mid_window;
+        int16_t* out = horizontal + i*width;
+        int j = mid_window;
+
+        for (; j + 16 <= last_col + 1; j += 16)
+        {
+            __m256i sum_lo = rounding;
+            __m256i sum_hi = rounding;
+
+            for (int v = 0; v < window_size; v += 2)
+            {
+                // Pair of taps, the last one is paired with zero
+                __m256i a = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i*) (row + j + v)));
+                __m256i b = zero;
+                int weights = kernel[v];
+
+                if (v + 1 < window_size)
+                {
+                    b = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i*) (row + j + v + 1)));
+                    weights |= kernel[v + 1] << 16;
+                }
+
+                __m256i w = _mm256_set1_epi32(weights);
+
+                // The unpacks work per 128 bit lane, packing the sums
+                // at the end restores the order of the pixels
+                sum_lo = _mm256_add_epi32(sum_lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), w));
+                sum_hi = _mm256_add_epi32(sum_hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), w));
+            }
+
+            sum_lo = _mm256_srai_epi32(sum_lo, shift);
+            sum_hi = _mm256_srai_epi32(sum_hi, shift);
+            _mm256_storeu_si256((__m256i*) (out + j), _mm256_packs_epi32(sum_lo, sum_hi));
+        }
+
+        // Remaining pixels
+        for (; j <= last_col; j++)
+        {
+            int32_t sum = 0;
+
+            for (int v = 0; v < window_size; v++)
+            {
+                sum += kernel[v]*row[j + v];
+            }
+
+            out[j] = (int16_t) ((sum + (1 << (shift - 1))) >> shift);
+        }
+    }
+}
+
+/**
+ * AVX2 version of gaussian_fixed_vertical_scalar. Sixteen pixels are
+ * computed at once, every vpmaddwd applies two taps of the kernel.
+ */
+TARGET_AVX2 void gaussian_fixed_vertical_avx2(int16_t* horizontal,
+                                              uint8_t* filtered, int width,
+                                              int height, uint16_t* kernel,
+                                              int window_size)
+{
+    // Get the middle of the window
+    int mid_window = (int) (window_size - 1)/2;
+    int shift = GAUSSIAN_FIXED_BITS + GAUSSIAN_FIXED_EXTRA_BITS;
+    __m256i zero = _mm256_setzero_si256();
+    __m256i rounding = _mm256_set1_epi32(1 << (shift - 1));
+
+    // Last row and column whose window is inside of the image
+    int last_row = height - window_size + mid_window;
+    int last_col = width - window_size + mid_window;
+
+    for (int i = mid_window; i <= last_row; i++)
+    {
+        int16_t* col = horizontal + (i - mid_window)*width;
+        uint8_t* out = filtered + i*width;
+        int j = mid_window;
+
+        for (; j + 16 <= last_col + 1; j += 16)
+        {
+            __m256i sum_lo = rounding;
+            __m256i sum_hi = rounding;
+
+            for (int u = 0; u < window_size; u += 2)
+            {
+                // Pair of taps, the last one is paired with zero
+                __m256i a = _mm256_loadu_si256((__m256i*) (col + u*width + j));
+                __m256i b = zero;
+                int weights = kernel[u];
+
+                if (u + 1 < window_size)
+                {
+                    b = _mm256_loadu_si256((__m256i*) (col + (u + 1)*width + j));
+                    weights |= kernel[u + 1] << 16;
+                }
+
+                __m256i w = _mm256_set1_epi32(weights);
+
+                sum_lo = _mm256_add_epi32(sum_lo, _mm256_madd_epi16(_mm256_unpacklo_epi16(a, b), w));
+                sum_hi = _mm256_add_epi32(sum_hi, _mm256_madd_epi16(_mm256_unpackhi_epi16(a, b), w));
+            }
+
+            // Shift and saturate to 8 bits, the 64 bit permutation
+            // joins the bytes of both 128 bit lanes
+            sum_lo = _mm256_srai_epi32(sum_lo, shift);
+            sum_hi = _mm256_srai_epi32(sum_hi, shift);
+            __m256i value = _mm256_packs_epi32(sum_lo, sum_hi);
+            value = _mm256_permute4x64_epi64(_mm256_packus_epi16(value, value), 0x08);
+            _mm_storeu_si128((__m128i*) (out + j), _mm256_castsi256_si128(value));
+        }
+
+        // Remaining pixels
+        for (; j <= last_col; j++)
+        {
+            int32_t sum = 0;
+
+            for (int u = 0; u < window_size; u++)
+            {
+                sum += kernel[u]*col[u*width + j];
+            }
+
+            sum = (sum + (1 << (shift - 1))) >> shift;
+            out[j] = (uint8_t) MIN(MAX(sum, 0), 255);
+        }
+    }
+}
+
+/**
+ * AVX-512 version of gaussian_fixed_horizontal_scalar. Thirty two
+ * pixels are computed at once, every vpmaddwd applies two taps of the
+ * kernel.
+ */
+TARGET_AVX512 void gaussian_fixed_horizontal_avx512(uint8_t* img,
+                                                    int16_t* horizontal,
+                                                    int width, int height,
+                                                    uint16_t* kernel,
+                                                    int window_size)
+{
+    // Get the middle of the window
+    int mid_window = (int) (window_size - 1)/2;
+    int shift = GAUSSIAN_FIXED_BITS - GAUSSIAN_FIXED_EXTRA_BITS;
+    __m512i zero = _mm512_setzero_si512();
+    __m512i rounding = _mm512_set1_epi32(1 << (shift - 1));
+
+    // Last column whose window is inside of the row
+    int last_col = width - window_size + mid_window;
+
+    for (int i = 0; i < height; i++)
+    {
+        uint8_t* row = img + i*width - mid_window;
+        int16_t* out = horizontal + i*width;
+        int j = mid_window;
+
+        for (; j + 32 <= last_col + 1; j += 32)
+        {
+            __m512i sum_lo = rounding;
+            __m512i sum_hi = rounding;
+
+            for (int v = 0; v < window_size; v += 2)
+            {
+                // Pair of taps, the last one is paired with zero
+                __m512i a = _mm512_cvtepu8_epi16(_mm256_loadu_si256((__m256i*) (row + j + v)));
+                __m512i b = zero;
+                int weights = kernel[v];
+
+                if (v + 1 < window_size)
+                {
+                    b = _mm512_cvtepu8_epi16(_mm256_loadu_si256((__m256i*) (row + j + v + 1)));
+                    weights |= kernel[v + 1] << 16;
+                }
+
+                __m512i w = _mm512_set1_epi32(weights);
+
+                // The unpacks work per 128 bit lane, packing the sums
+                // at the end restores the order of the pixels
+                sum_lo = _mm512_add_epi32(sum_lo, _mm512_madd_epi16(_mm512_unpacklo_epi16(a, b), w));
+                sum_hi = _mm512_add_epi32(sum_hi, _mm512_madd_epi16(_mm512_unpackhi_epi16(a, b), w));
+            }
+
+            sum_lo = _mm512_srai_epi32(sum_lo, shift);
+            sum_hi = _mm512_srai_epi32(sum_hi, shift);
+            _mm512_storeu_si512((__m512i*) (out + j), _mm512_packs_epi32(sum_lo, sum_hi));
+        }
+
+        // Remaining pixels
+        for (; j <= last_col; j++)
+        {
+            int32_t sum = 0;
+
+            for (int v = 0; v < window_size; v++)
+            {
+                sum += kernel[v]*row[j + v];
+            }
+
+            out[j] = (int16_t) ((sum + (1 << (shift - 1))) >> shift);
+        }
+    }
+}
+
+/**
+ * AVX-512 version of gaussian_fixed_vertical_scalar. Thirty two pixels
+ * are computed at once, every vpmaddwd applies two taps of the kernel.
+ */
+TARGET_AVX512 void gaussian_fixed_vertical_avx512(int16_t* horizontal,
+                                                  uint8_t* filtered, int width,
+                                                  int height, uint16_t* kernel,
+                                                  int window_size)
+{
+    // Get the middle of the window
+    int mid_window = (int) (window_size - 1)/2;
+    int shift = GAUSSIAN_FIXED_BITS + GAUSSIAN_FIXED_EXTRA_BITS;
+    __m512i zero = _mm512_setzero_si512();
+    __m512i rounding = _mm512_set1_epi32(1 << (shift - 1));
+
+    // Last row and column whose window is inside of the image
+    int last_row = height - window_size + mid_window;
+    int last_col = width - window_size + mid_window;
+
+    for (int i = mid_window; i <= last_row; i++)
+    {
+        int16_t* col = horizontal + (i - mid_window)*width;
+        uint8_t* out = filtered + i*width;
+        int j = mid_window;
+
+        for (; j + 32 <= last_col + 1; j += 32)
+        {
+            __m512i sum_lo = rounding;
+            __m512i sum_hi = rounding;
+
+            for (int u = 0; u < window_size; u += 2)
+            {
+                // Pair of taps, the last one is paired with zero
+                __m512i a = _mm512_loadu_si512((__m512i*) (col + u*width + j));
+                __m512i b = zero;
+                int weights = kernel[u];
+
+                if (u + 1 < window_size)
+                {
+                    b = _mm512_loadu_si512((__m512i*) (col + (u + 1)*width + j));
+                    weights |= kernel[u + 1] << 16;
+                }
+
+                __m512i w = _mm512_set1_epi32(weights);
+
+                sum_lo = _mm512_add_epi32(sum_lo, _mm512_madd_epi16(_mm512_unpacklo_epi16(a, b), w));
+                sum_hi = _mm512_add_epi32(sum_hi, _mm512_madd_epi16(_mm512_unpackhi_epi16(a, b), w));
+            }
+
+            // Shift and saturate to 8 bits
+            sum_lo = _mm512_srai_epi32(sum_lo, shift);
+            sum_hi = _mm512_srai_epi32(sum_hi, shift);
+            __m512i value = _mm512_max_epi16(_mm512_packs_epi32(sum_lo, sum_hi), zero);
+            _mm256_storeu_si256((__m256i*) (out + j), _mm512_cvtusepi16_epi8(value));
+        }
+
+        // Remaining pixels
+        for (; j <= last_col; j++)
+        {
+            int32_t sum = 0;
+
+            for (int u = 0; u < window_size; u++)
+            {
+                sum += kernel[u]*col[u*width + j];
+            }
+
+            sum = (sum + (1 << (shift - 1))) >> shift;
+            out[j] = (uint8_t) MIN(MAX(sum, 0), 255);
+        }
+    }
+}
+
+#endif
+
+/**
+ * This function performs a separable gaussian filtering on an image
+ * using fixed point weights. The pixels are accumulated in 32 bit
+ * integers by the SIMD kernels bound by select_kernels.
+ *
+ * Params:
+ *      uint8_t* img - image to filter.
+ *      uint8_t* filtered - pointer to the filtered image.
+ *      int width - number of cols.
+ *      int height - number of rows.
+ *      int window_size - size of the window.
+ *      double stdev - standard deviation of the gaussian
+ *                     distribution.
+ */
+void gaussian_filter_fixed(uint8_t* img, uint8_t* filtered, int width,
+                           int height, int window_size, double stdev)
+{
+    // Get memory for the kernel and the horizontally filtered image
+    uint16_t* gaussian_kernel = (uint16_t*) calloc(window_size, sizeof(uint16_t));
+    int16_t* horizontal = (int16_t*) calloc(width*height, sizeof(int16_t));
+
+    if (gaussian_kernel == NULL || horizontal == NULL)
+    {
+        printf("Unable to allocate memory for the fixed point filter.\n");
+        exit(1);
+    }
+
+    // Get the gaussian kernel
+    get_gaussian_kernel_fixed(gaussian_kernel, window_size, stdev);
+
+    // Horizontal and vertical passes
+    kernels.gaussian_fixed_horizontal(img, horizontal, width, height, gaussian_kernel, window_size);
+    kernels.gaussian_fixed_vertical(horizontal, filtered, width, height, gaussian_kernel, window_size);
+
+    // Free memory
+    free(gaussian_kernel);
+    free(horizontal);
+}
+
+/**
+ * This function performs a recursive gaussian filtering on an image
+ * using the Young-van Vliet approximation. Each pass runs a third
+ * order causal filter followed by an anti-causal one, so the cost per
+ * pixel does not depend on the standard deviation. The image edges
+ * are extended with the border value and every pixel is filtered.
+ *
+ * Params:
+ *      uint8_t* img - image to filter.
+ *      uint8_t* filtered - pointer to the filtered image.
+ *      int width - number of cols.
+ *      int height - number of rows.
+ *      double stdev - standard deviation of the gaussian
+ *                     distribution, values below 0.5 are clamped.
+ */
+void gaussian_filter_recursive(uint8_t* img, uint8_t* filtered, int width,
+                               int height, double stdev)
+{
+    double q;
+
+    // Get the filter scale from the standard deviation
+    if (stdev < 0.5)
+    {
+        stdev = 0.5;
+    }
+
+    if (stdev >= 2.5)
+    {
+        q = 0.98711*stdev - 0.96330;
+    } else
+    {
+        q = 3.97156 - 4.14554*sqrt(1 - 0.26891*stdev);
+    }
+
+    // Get the filter coefficients
+    double b0 = 1.57825 + 2.44413*q + 1.4281*q*q + 0.422205*q*q*q;
+    double b1 = (2.44413*q + 2.85619*q*q + 1.26661*q*q*q)/b0;
+    double b2 = -(1.4281*q*q + 1.26661*q*q*q)/b0;
+    double b3 = (0.422205*q*q*q)/b0;
+    double B = 1 - (b1 + b2 + b3);
+
+    // Get memory for the intermediate image
+    double* buffer = (double*) calloc(width*height, sizeof(double));
+
+    if (buffer == NULL)
+    {
+        printf("Unable to allocate memory for the recursive filter.\n");
+        exit(1);
+    }
+
+    // Horizontal pass
+    for (int i = 0; i < height; i++)
+    {
+        uint8_t* row = img + i*width;
+        double* out = buffer + i*width;
+
+        // Causal filter, the state starts at the left border value
+        double w1 = row[0], w2 = row[0], w3 = row[0];
+
+        for (int j = 0; j < width; j++)
+        {
+            double w0 = B*row[j] + b1*w1 + b2*w2 + b3*w3;
+
+            out[j] = w0;
+            w3 = w2;
+            w2 = w1;
+            w1 = w0;
+        }
+
+        // Anti-causal filter, the state starts at the right border value
+        w1 = w2 = w3 = out[width - 1];
+
+        for (int j = width - 1; j >= 0; j--)
+        {
+            double w0 = B*out[j] + b1*w1 + b2*w2 + b3*w3;
+
+            out[j] = w0;
+            w3 = w2;
+            w2 = w1;
+            w1 = w0;
+        }
+    }
+
+    // Vertical causal filter, rows are processed in order to keep the
+    // accesses contiguous
+    for (int i = 0; i < height; i++)
+    {
+        double* out = buffer + i*width;
+        double* prev1 = buffer + MAX(i - 1, 0)*width;
+        double* prev2 = buffer + MAX(i - 2, 0)*width;
+        double* prev3 = buffer + MAX(i - 3, 0)*width;
+
+        // The first row only sees its own value as state
+        if (i == 0)
+        {
+            continue;
+        }
+
+        for (int j = 0; j < width; j++)
+        {
+            out[j] = B*out[j] + b1*prev1[j] + b2*prev2[j] + b3*prev3[j];
+        }
+    }
+
+    // Vertical anti-causal filter
+    for (int i = height - 1; i >= 0; i--)
+    {
+        double* out = buffer + i*width;
+        double* next1 = buffer + MIN(i + 1, height - 1)*width;
+        double* next2 = buffer + MIN(i + 2, height - 1)*width;
+        double* next3 = buffer + MIN(i + 3, height - 1)*width;
+
+        if (i == height - 1)
+        {
+            continue;
+        }
+
+        for (int j = 0; j < width; j++)
+        {
+            out[j] = B*out[j] + b1*next1[j] + b2*next2[j] + b3*next3[j];
+        }
+    }
+
+    for (int i = 0; i < width*height; i++)
+    {
+        uint8_t value = 0;
+
+        // Keep the pixel value between 0 and 255, avoiding
+        // unexpected values
+        if (buffer[i] > 255)
+        {
+            value = 255;
+        } else if (buffer[i] > 0)
+        {
+            value = (uint8_t) round(buffer[i]);
+        }
+
+        // Set the pixel
+        filtered[i] = value;
+    }
+
+    // Free memory
+    free(buffer);
+}
+
+
+/**
+ * This function computes the sizes of the box filters whose cascade
+ * approximates a gaussian distribution with a standard deviation of
+ * stdev. The sizes are odd and the variance of the cascade is the
+ * closest to stdev^2.
+ *
+ * Params:
+ *      int* sizes - pointer to store the size of each box.
+ *      int boxes - number of boxes.
+ *      double stdev - standard deviation of the gaussian
+ *                     distribution.
+ */
+void get_box_sizes(int* sizes, int boxes, double stdev)
+{
+    // Ideal size of the boxes if all of them had the same size
+    double ideal = sqrt(12*stdev*stdev/boxes + 1);
+
+    // Lower odd size
+    int lower = (int) floor(ideal);
+
+    if (lower % 2 == 0)
+    {
+        lower--;
+    }
+
+    // Number of boxes that use the lower size, the rest use lower + 2
+    int m = (int) round((12*stdev*stdev - boxes*lower*lower - 4*boxes*lower - 3*boxes)/(-4.0*lower - 4));
+
+    for (int i = 0; i < boxes; i++)
+    {
+        sizes[i] = i < m ? lower : lower + 2;
+    }
+}
+
+/**
+ * This function performs a horizontal box filtering on an image with
+ * a running sum. The image edges are extended with the border value.
+ *
+ * Params:
+ *      uint8_t* img - image to filter.
+ *      uint8_t* filtered - pointer to the filtered image.
+ *      int width - number of cols.
+ *      int height - number of rows.
+ *      int size - size of the box, it must be odd.
+ */
+void box_filter_horizontal(uint8_t* img, uint8_t* filtered, int width,
+                           int height, int size)
+{
+    int radius = size/2;
+
+    // Fixed point reciprocal of the box size
+    uint32_t scale = ((1u << 16) + size/2)/size;
+
+    for (int i = 0; i < height; i++)
+    {
+        uint8_t* row = img + i*width;
+        uint8_t* out = filtered + i*width;
+
+        // Sum of the box centered in the first pixel
+        uint32_t sum = (radius + 1)*row[0];
+
+        for (int j = 1; j <= radius; j++)
+        {
+            sum += row[MIN(j, width - 1)];
+        }
+
+        for (int j = 0; j < width; j++)
+        {
+            out[j] = (uint8_t) ((sum*scale + (1u << 15)) >> 16);
+
+            // Slide the box one pixel to the right
+            sum += row[MIN(j + radius + 1, width - 1)];
+            sum -= row[MAX(j - radius, 0)];
+        }
+    }
+}
+
+/**
+ * This function performs a vertical box filtering on an image with a
+ * running sum per column. The rows are processed in order to keep the
+ * accesses contiguous. The image edges are extended with the border
+ * value.
+ *
+ * Params:
+ *      uint8_t* img - image to filter.
+ *      uint8_t* filtered - pointer to the filtered image.
+ *      uint32_t* sums - pointer to store the sum of each column.
+ *      int width - number of cols.
+ *      int height - number of rows.
+ *      int size - size of the box, it must be odd.
+ */
+void box_filter_vertical(uint8_t* img, uint8_t* filtered, uint32_t* sums,
+                         int width, int height, int size)
+{
+    int radius = size/2;
+
+    // Fixed point reciprocal of the box size
+    uint32_t scale = ((1u << 16) + size/2)/size;
+
+    // Sum of the boxes centered in the first row
+    for (int j = 0; j < width; j++)
+    {
+        sums[j] = (radius + 1)*img[j];
+    }
+
+    for (int i = 1; i <= radius; i++)
+    {
+        uint8_t* row = img + MIN(i, height - 1)*width;
+
+        for (int j = 0; j < width; j++)
+        {
+            sums[j] += row[j];
+        }
+    }
+
+    for (int i = 0; i < height; i++)
+    {
+        uint8_t* out = filtered + i*width;
+        uint8_t* next = img + MIN(i + radius + 1, height - 1)*width;
+        uint8_t* last = img + MAX(i - radius, 0)*width;
+
+        for (int j = 0; j < width; j++)
+        {
+            out[j] = (uint8_t) ((sums[j]*scale + (1u << 15)) >> 16);
+
+            // Slide the box one pixel down
+            sums[j] += next[j];
+            sums[j] -= last[j];
+        }
+    }
+}
+
+/**
+ * This function approximates a gaussian filtering on an image with a
+ * cascade of box filters. Each box is computed with running sums, so
+ * the cost per pixel only depends on the number of boxes and all the
+ * operations are on integers. The image edges are extended with the
+ * border value and every pixel is filtered.
+ *
+ * Params:
+ *      uint8_t* img - image to filter.
+ *      uint8_t* filtered - pointer to the filtered image.
+ *      int width - number of cols.
+ *      int height - number of rows.
+ *      double stdev - standard deviation of the gaussian
+ *                     distribution.
+ *      int boxes - number of box filters, between 3 and 5.
+ */
+void gaussian_filter_box(uint8_t* img, uint8_t* filtered, int width,
+                         int height, double stdev, int boxes)
+{
+    int sizes[5];
+
+    // Get the size of each box
+    boxes = MIN(MAX(boxes, 3), 5);
+    get_box_sizes(sizes, boxes, stdev);
+
+    // Get memory for the intermediate images and the column sums
+    uint8_t* buffer = (uint8_t*) calloc(width*height, sizeof(uint8_t));
+    uint32_t* sums = (uint32_t*) calloc(width, sizeof(uint32_t));
+
+    if (buffer == NULL || sums == NULL)
+    {
+        printf("Unable to allocate memory for the box filter.\n");
+        exit(1);
+    }
+
+    // The first box reads the image and every box leaves its result in
+    // the filtered image
+    uint8_t* src = img;
+
+    for (int k = 0; k < boxes; k++)
+    {
+        box_filter_horizontal(src, buffer, width, height, sizes[k]);
+        box_filter_vertical(buffer, filtered, sums, width, height, sizes[k]);
+        src = filtered;
+    }
+
+    // Free memory
+    free(buffer);
+    free(sums);
+}
+
+// Specialized row passes of an instruction set
+#define SPECIALIZED_ROWS(isa)                                                \
+    {gaussian_horizontal_row_##isa##_3, gaussian_horizontal_row_##isa##_5,   \
+     gaussian_horizontal_row_##isa##_7, gaussian_horizontal_row_##isa##_9,   \
+     gaussian_horizontal_row_##isa##_11},                                    \
+    {gaussian_vertical_row_##isa##_3, gaussian_vertical_row_##isa##_5,       \
+     gaussian_vertical_row_##isa##_7, gaussian_vertical_row_##isa##_9,       \
+     gaussian_vertical_row_##isa##_11}
+
+/**
+ * This function binds the kernels to the widest instruction set
+ * supported by the CPU, or to the one requested if the CPU supports
+ * it. The CPU is probed with CPUID only once. If there are kernels
+ * specialized for the window size, they replace the generic ones.
+ *
+ * Params:
+ *      const char* isa - name of the instruction set to use (scalar,
+ *                        sse2, avx2 or avx512) or NULL to use the
+ *                        widest one.
+ *      int window_size - size of the window given in the arguments.
+ *
+ * Returns:
+ *      const char* - name of the instruction set bound.
+ */
+const char* select_kernels(const char* isa, int window_size)
+{
+    // Instruction set variants, from the narrowest to the widest
+    static const filter_kernels_t variants[] = {
+        {"scalar", rgb2gray_scalar, gaussian_horizontal_row_scalar,
+         gaussian_vertical_row_scalar, gaussian_horizontal_row_float_scalar,
+         gaussian_vertical_row_float_scalar, gaussian_fixed_horizontal_scalar,
+         gaussian_fixed_vertical_scalar, SPECIALIZED_ROWS(scalar)},
+#ifdef HAVE_X86_SIMD
+        {"sse2", rgb2gray_sse2, gaussian_horizontal_row_sse2,
+         gaussian_vertical_row_sse2, gaussian_horizontal_row_float_sse2,
+         gaussian_vertical_row_float_sse2, gaussian_fixed_horizontal_sse2,
+         gaussian_fixed_vertical_sse2, SPECIALIZED_ROWS(sse2)},
+        {"avx2", rgb2gray_avx2, gaussian_horizontal_row_avx2,
+         gaussian_vertical_row_avx2, gaussian_horizontal_row_float_avx2,
+         gaussian_vertical_row_float_avx2, gaussian_fixed_horizontal_avx2,
+         gaussian_fixed_vertical_avx2, SPECIALIZED_ROWS(avx2)},
+        {"avx512", rgb2gray_avx512, gaussian_horizontal_row_avx512,
+         gaussian_vertical_row_avx512, gaussian_horizontal_row_float_avx512,
+         gaussian_vertical_row_float_avx512, gaussian_fixed_horizontal_avx512,
+         gaussian_fixed_vertical_avx512, SPECIALIZED_ROWS(avx512)},
+#endif
+    };
+    static int best = -1;
+    int selected;
+
+    if (best < 0)
+    {
+        best = 0;
+
+#ifdef HAVE_X86_SIMD
+        __builtin_cpu_init();
+
+        if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+        {
+            best = 3;
+        } else if (__builtin_cpu_supports("avx2"))
+        {
+            best = 2;
+        } else if (__builtin_cpu_supports("sse2"))
+        {
+            best = 1;
+        }
+#endif
+    }
+
+    selected = best;
+
+    if (isa != NULL)
+    {
+        int count = sizeof(variants)/sizeof(variants[0]);
+
+        for (selected = 0; selected < count; selected++)
+        {
+            if (strcmp(variants[selected].isa, isa) == 0)
+            {
+                break;
+            }
+        }
+
+        if (selected == count)
+        {
+            printf("Unknown instruction set %s, using %s.\n", isa, variants[best].isa);
+            selected = best;
+        } else if (selected > best)
+        {
+            printf("The CPU does not support %s, using %s.\n", isa, variants[best].isa);
+            selected = best;
+        }
+    }
+
+    kernels = variants[selected];
+
+    // Specializations are generated for odd sizes from 3 to 11
+    if (window_size >= 3 && window_size <= 11 && window_size % 2 == 1)
+    {
+        int index = (window_size - 3)/2;
+
+        kernels.gaussian_horizontal_row = kernels.gaussian_horizontal_row_sized[index];
+        kernels.gaussian_vertical_row = kernels.gaussian_vertical_row_sized[index];
+    }
+
+    return kernels.isa;
+}
+
+/**
+ * Gaussian filter implementations that can be selected from the
+ * command line.
+ */
+typedef enum
+{
+    // Separable FIR filter (gaussian_filter)
+    GAUSSIAN_FIR,
+    // 2D FIR filter (gaussian_filter_direct)
+    GAUSSIAN_DIRECT,
+    // Recursive filter (gaussian_filter_recursive)
+    GAUSSIAN_IIR,
+    // Box filter cascade (gaussian_filter_box)
+    GAUSSIAN_BOX,
+    // Fixed point separable FIR filter (gaussian_filter_fixed)
+    GAUSSIAN_FIXED,
+    // Single precision separable FIR filter (gaussian_filter_float)
+    GAUSSIAN_FLOAT
+} gaussian_mode_t;
+
+/**
+ * Options given to the program with --name=value arguments.
+ */
+typedef struct
+{
+    // Filter implementation
+    gaussian_mode_t mode;
+    // Number of box filters for GAUSSIAN_BOX
+    int boxes;
+    // Compare the result against the direct filter
+    int report;
+    // Instruction set of the kernels, NULL to use the widest one
+    const char* isa;
+} gaussian_options_t;
+
+/**
+ * This function reads the --name=value options from the arguments and
+ * removes them, leaving only the positional arguments in argv.
+ *
+ * Params:
+ *      int argc - number of arguments.
+ *      char* argv[] - arguments.
+ *      gaussian_options_t* options - pointer to store the options.
+ *
+ * Returns:
+ *      int - number of arguments left in argv or -1 if an option is
+ *            not valid.
+ */
+int parse_options(int argc, char* argv[], gaussian_options_t* options)
+{
+    int positional = 1;
+
+    // Default options
+    options->mode = GAUSSIAN_FIR;
+    options->boxes = 3;
+    options->report = 0;
+    options->isa = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], "--", 2) != 0)
+        {
+            // Keep the positional argument
+            argv[positional++] = argv[i];
+        } else if (strcmp(argv[i], "--mode=fir") == 0)
+        {
+            options->mode = GAUSSIAN_FIR;
+        } else if (strcmp(argv[i], "--mode=direct") == 0)
+        {
+            options->mode = GAUSSIAN_DIRECT;
+        } else if (strcmp(argv[i], "--mode=iir") == 0)
+        {
+            options->mode = GAUSSIAN_IIR;
+        } else if (strcmp(argv[i], "--mode=box") == 0)
+        {
+            options->mode = GAUSSIAN_BOX;
+        } else if (strcmp(argv[i], "--mode=fixed") == 0)
+        {
+            options->mode = GAUSSIAN_FIXED;
+        } else if (strcmp(argv[i], "--mode=float") == 0)
+        {
+            options->mode = GAUSSIAN_FLOAT;
+        } else if (strncmp(argv[i], "--boxes=", 8) == 0)
+        {
+            options->boxes = atoi(argv[i] + 8);
+
+            if (options->boxes < 3 || options->boxes > 5)
+            {
+                printf("The number of boxes must be between 3 and 5.\n");
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--report") == 0)
+        {
+            options->report = 1;
+        } else if (strncmp(argv[i], "--isa=", 6) == 0)
+        {
+            options->isa = argv[i] + 6;
+        } else
+        {
+            printf("Unknown option %s.\n", argv[i]);
+            return -1;
+        }
+    }
+
+    return positional;
+}
+
+/**
+ * This function filters an image with the selected gaussian filter
+ * implementation.
+ *
+ * Params:
+ *      uint8_t* img - image to filter.
+ *      uint8_t* filtered - pointer to the filtered image.
+ *      int width - number of cols.
+ *      int height - number of rows.
+ *      int window_size - size of the window.
+ *      double stdev - standard deviation of the gaussian
+ *                     distribution.
+ *      gaussian_options_t* options - filter implementation and its
+ *                                    options.
+ */
+void apply_gaussian_filter(uint8_t* img, uint8_t* filtered, int width,
+                           int height, int window_size, double stdev,
+                           gaussian_options_t* options)
+{
+    switch (options->mode)
+    {
+        case GAUSSIAN_DIRECT:
+            gaussian_filter_direct(img, filtered, width, height, window_size, stdev);
+            break;
+        case GAUSSIAN_IIR:
+            gaussian_filter_recursive(img, filtered, width, height, stdev);
+            break;
+        case GAUSSIAN_BOX:
+            gaussian_filter_box(img, filtered, width, height, stdev, options->boxes);
+            break;
+        case GAUSSIAN_FIXED:
+            gaussian_filter_fixed(img, filtered, width, height, window_size, stdev);
+            break;
+        case GAUSSIAN_FLOAT:
+            gaussian_filter_float(img, filtered, width, height, window_size, stdev);
+            break;
+        default:
+            gaussian_filter(img, filtered, width, height, window_size, stdev);
+            break;
+    }
+}
+
+/**
+ * This function prints how far a filtered image drifts from a
+ * reference. Only the pixels where the reference is defined (where
+ * the window is inside of the image) are compared.
+ *
+ * Params:
+ *      const char* name - name of the image.
+ *      uint8_t* reference - reference image.
+ *      uint8_t* filtered - image to compare.
+ *      int width - number of cols.
+ *      int height - number of rows.
+ *      int window_size - size of the window.
+ */
+void print_accuracy_report(const char* name, uint8_t* reference,
+                           uint8_t* filtered, int width, int height,
+                           int window_size)
+{
+    // Get the middle of the window
+    int mid_window = (int) (window_size - 1)/2;
+
+    // Last row and column whose window is inside of the image
+    int last_row = height - window_size + mid_window;
+    int last_col = width - window_size + mid_window;
+
+    int max_error = 0;
+    double abs_error = 0.0;
+    double squared_error = 0.0;
+    long pixels = 0;
+
+    for (int i = mid_window; i <= last_row; i++)
+    {
+        for (int j = mid_window; j <= last_col; j++)
+        {
+            int error = abs(reference[i*width + j] - filtered[i*width + j]);
+
+            max_error = MAX(max_error, error);
+            abs_error += error;
+            squared_error += error*error;
+            pixels++;
+        }
+    }
+
+    if (pixels == 0)
+    {
+        printf("%s: the image is smaller than the window.\n", name);
+        return;
+    }
+
+    double mse = squared_error/pixels;
+
+    if (mse == 0)
+    {
+        printf("%s: max error 0, mean error 0.0000, PSNR inf dB\n", name);
+    } else
+    {
+        printf("%s: max error %d, mean error %.4f, PSNR %.2f dB\n", name,
+               max_error, abs_error/pixels, 10*log10(255.0*255.0/mse));
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    gaussian_options_t options;
+
+    // Remove the options from the arguments
+    argc = parse_options(argc, argv, &options);
+
+    if (argc < 4)
+    {
+        printf("Args were not provided. `make gaussian w=3 sigma=1.5 imgs=\"img1 img2 img3 etc\" opts=\"--mode=fir|direct|iir|box|fixed|float --boxes=3 --report --isa=scalar|sse2|avx2|avx512\"`.\n");
+    }
+    else
+    {
+        // Convert to numbers
+        int win_size = atoi(argv[1]);
+        float sigma = atof(argv[2]);
+
+        // Bind the kernels to the instruction set of this CPU
+        printf("Using %s kernels.\n", select_kernels(options.isa, win_size));
+
+        // Apply the filter to all images
+        for (int i = 3; i < argc; i++)
+        {
+            int width, height, channels;
+
+            // Load image
+            uint8_t* rgb_img = stbi_load(argv[i], &width, &height, &channels, 3);
+
+            if (rgb_img == NULL)
+            {
+                printf("Error loading the image in %s.\n", argv[i]);
+                continue;
+            }
+
+            // Convert image to gray
+            size_t img_size = width * height * 3;
+            size_t gray_img_size = width * height;
+
+            uint8_t* gray_img = (uint8_t*) calloc(gray_img_size, sizeof(uint8_t));
+
+            if (gray_img == NULL)
+            {
+                printf("Unable to allocate memory for the gray image.\n");
+                exit(1);
+            }
+
+            kernels.rgb2gray(rgb_img, gray_img, img_size);
+
+            // Allocate memory for the filtered image
+            uint8_t* filtered_img = (uint8_t*) calloc(gray_img_size, sizeof(uint8_t));
+
+            if (filtered_img == NULL)
+            {
+                printf("Unable to allocate memory for the filtered image.\n");
+                exit(1);
+            }
+
+            // Gaussian filtering
+            apply_gaussian_filter(gray_img, filtered_img, width, height, win_size, sigma, &options);
+
+            if (options.report)
+            {
+                // Allocate memory for the reference image
+                uint8_t* reference_img = (uint8_t*) calloc(gray_img_size, sizeof(uint8_t));
+
+                if (reference_img == NULL)
+                {
+                    printf("Unable to allocate memory for the reference image.\n");
+                    exit(1);
+                }
+
+                // Compare against the direct filter
+                gaussian_filter_direct(gray_img, reference_img, width, height, win_size, sigma);
+                print_accuracy_report(argv[i], reference_img, filtered_img, width, height, win_size);
+
+                free(reference_img);
+            }
 
             char output[26];
             sprintf(output, "%s%d%s", "outputs/gaussian", i - 3, ".jpg");
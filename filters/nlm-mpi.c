@@ -1,13 +1,68 @@
 #include <mpi.h>
+#include <pthread.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/param.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "libs/stb/stb_image.h"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "libs/stb/stb_image_write.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_SIMD
+#include <immintrin.h>
+
+// Kernels compiled for an instruction set, they are only called after
+// checking that the CPU supports it
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#define TARGET_AVX512 __attribute__((target("avx2,avx512f,avx512bw")))
+#endif
+
+// Kernels that must not be vectorized by the compiler
+#define TARGET_SCALAR __attribute__((optimize("no-tree-vectorize")))
+// Generic kernels, they are inlined in every instruction set variant
+#define INLINE_KERNEL static inline __attribute__((always_inline))
+
+// Window sizes with kernels specialized at compile time
+#define SPECIALIZED_SIZES 5
+#define FOR_EACH_SPECIALIZED_SIZE(X, isa, target)                            \
+    X(isa, target, 3) X(isa, target, 5) X(isa, target, 7)                    \
+    X(isa, target, 9) X(isa, target, 11)
+
+
+
+// Sum of squared differences between two windows read in place from
+// the image
+typedef uint32_t (*patch_ssd_t)(uint8_t* v, uint8_t* u, int width,
+                                int size);
+
+/**
+ * Instruction set variants of the kernels, selected at startup by
+ * select_kernels.
+ */
+typedef struct
+{
+    // Name of the instruction set
+    const char* isa;
+    void (*rgb2gray)(uint8_t* img, uint8_t* gray_ptr, int img_size);
+    patch_ssd_t patch_ssd;
+    // Kernels specialized for windows of size 3, 5, 7, 9 and 11
+    patch_ssd_t patch_ssd_sized[SPECIALIZED_SIZES];
+} filter_kernels_t;
+
+// Kernels used by the filters
+static filter_kernels_t kernels;
 
 /**
  * This function converts a RGB image to a gray image.
@@ -17,186 +72,4440 @@
  *      uint8_t* gray_prt - pointer to store the image.
  *      int img_sime - size of the image.
  */
-void rgb2gray(uint8_t* img, uint8_t* gray_ptr, int img_size)
+INLINE_KERNEL void rgb2gray(uint8_t* img, uint8_t* gray_ptr, int img_size)
+{
+    uint8_t* img_ptr = img;
+
+    while (img_ptr != img + img_size)
+    {
+        // Convert RGB pixel to gray
+        *gray_ptr = (uint8_t)(0.3*(*img_ptr) + 0.59*(*(img_ptr + 1)) + 0.11*(*(img_ptr + 2)));
+
+        // Next pixel
+        img_ptr += 3;
+        gray_ptr++;
+    }
+}
+
+// Instruction set variants of rgb2gray
+#define DEFINE_RGB2GRAY(isa, target)                                         \
+    target void rgb2gray_##isa(uint8_t* img, uint8_t* gray_ptr,              \
+                               int img_size)                                 \
+    {                                                                        \
+        rgb2gray(img, gray_ptr, img_size);                                   \
+    }
+
+DEFINE_RGB2GRAY(scalar, TARGET_SCALAR)
+#ifdef HAVE_X86_SIMD
+DEFINE_RGB2GRAY(sse2, TARGET_SSE2)
+DEFINE_RGB2GRAY(avx2, TARGET_AVX2)
+DEFINE_RGB2GRAY(avx512, TARGET_AVX512)
+#endif
+
+/**
+ * This function computes the sum of squared differences between two
+ * windows read in place from the image. The differences are integers,
+ * so no intermediate buffer or floating point operation is needed.
+ *
+ * Params:
+ *      uint8_t* v - top left pixel of the first window.
+ *      uint8_t* u - top left pixel of the second window.
+ *      int width - number of columns in the image.
+ *      int size - size of the windows.
+ *
+ * Returns:
+ *      uint32_t - sum of squared differences.
+ */
+INLINE_KERNEL uint32_t patch_ssd(uint8_t* v, uint8_t* u, int width,
+                                 int size)
+{
+    uint32_t ssd = 0;
+
+    #pragma GCC unroll 16
+    for (int i = 0; i < size; i++)
+    {
+        #pragma GCC unroll 16
+        for (int j = 0; j < size; j++)
+        {
+            int difference = (int) v[i*width + j] - (int) u[i*width + j];
+
+            ssd += difference*difference;
+        }
+    }
+
+    return ssd;
+}
+
+/**
+ * Scalar version of patch_ssd.
+ */
+TARGET_SCALAR uint32_t patch_ssd_scalar(uint8_t* v, uint8_t* u, int width,
+                                        int size)
+{
+    return patch_ssd(v, u, width, size);
+}
+
+#ifdef HAVE_X86_SIMD
+/**
+ * SSE2 version of patch_ssd. Rows are read eight pixels at a time,
+ * widened to 16 bits and squared and summed in pairs with pmaddwd.
+ */
+TARGET_SSE2 uint32_t patch_ssd_sse2(uint8_t* v, uint8_t* u, int width,
+                                    int size)
+{
+    __m128i zero = _mm_setzero_si128();
+    __m128i sum = zero;
+    uint32_t ssd = 0;
+
+    for (int i = 0; i < size; i++)
+    {
+        uint8_t* a = v + i*width;
+        uint8_t* b = u + i*width;
+        int j = 0;
+
+        for (; j + 8 <= size; j += 8)
+        {
+            __m128i x = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i*) (a + j)), zero);
+            __m128i y = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i*) (b + j)), zero);
+            __m128i difference = _mm_sub_epi16(x, y);
+
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(difference, difference));
+        }
+
+        // Remaining pixels of the row
+        for (; j < size; j++)
+        {
+            int difference = (int) a[j] - (int) b[j];
+
+            ssd += difference*difference;
+        }
+    }
+
+    // Horizontal sum of the four lanes
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+
+    return ssd + (uint32_t) _mm_cvtsi128_si32(sum);
+}
+
+/**
+ * AVX2 version of patch_ssd. Rows are read sixteen pixels at a time,
+ * then eight, widened to 16 bits and squared and summed in pairs with
+ * vpmaddwd.
+ */
+TARGET_AVX2 uint32_t patch_ssd_avx2(uint8_t* v, uint8_t* u, int width,
+                                    int size)
+{
+    __m256i sum = _mm256_setzero_si256();
+    __m128i sum_half = _mm_setzero_si128();
+    uint32_t ssd = 0;
+
+    for (int i = 0; i < size; i++)
+    {
+        uint8_t* a = v + i*width;
+        uint8_t* b = u + i*width;
+        int j = 0;
+
+        for (; j + 16 <= size; j += 16)
+        {
+            __m256i x = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i*) (a + j)));
+            __m256i y = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i*) (b + j)));
+            __m256i difference = _mm256_sub_epi16(x, y);
+
+            sum = _mm256_add_epi32(sum, _mm256_madd_epi16(difference, difference));
+        }
+
+        for (; j + 8 <= size; j += 8)
+        {
+            __m128i x = _mm_cvtepu8_epi16(_mm_loadl_epi64((__m128i*) (a + j)));
+            __m128i y = _mm_cvtepu8_epi16(_mm_loadl_epi64((__m128i*) (b + j)));
+            __m128i difference = _mm_sub_epi16(x, y);
+
+            sum_half = _mm_add_epi32(sum_half, _mm_madd_epi16(difference, difference));
+        }
+
+        // Remaining pixels of the row
+        for (; j < size; j++)
+        {
+            int difference = (int) a[j] - (int) b[j];
+
+            ssd += difference*difference;
+        }
+    }
+
+    // Horizontal sum of the eight lanes
+    sum_half = _mm_add_epi32(sum_half, _mm256_castsi256_si128(sum));
+    sum_half = _mm_add_epi32(sum_half, _mm256_extracti128_si256(sum, 1));
+    sum_half = _mm_hadd_epi32(sum_half, sum_half);
+    sum_half = _mm_hadd_epi32(sum_half, sum_half);
+
+    return ssd + (uint32_t) _mm_cvtsi128_si32(sum_half);
+}
+
+/**
+ * AVX-512 version of patch_ssd. Rows are read thirty two pixels at a
+ * time, then sixteen and eight, widened to 16 bits and squared and
+ * summed in pairs with vpmaddwd.
+ */
+TARGET_AVX512 uint32_t patch_ssd_avx512(uint8_t* v, uint8_t* u, int width,
+                                        int size)
+{
+    __m512i sum = _mm512_setzero_si512();
+    __m256i sum_half = _mm256_setzero_si256();
+    __m128i sum_quarter = _mm_setzero_si128();
+    uint32_t ssd = 0;
+
+    for (int i = 0; i < size; i++)
+    {
+        uint8_t* a = v + i*width;
+        uint8_t* b = u + i*width;
+        int j = 0;
+
+        for (; j + 32 <= size; j += 32)
+        {
+            __m512i x = _mm512_cvtepu8_epi16(_mm256_loadu_si256((__m256i*) (a + j)));
+            __m512i y = _mm512_cvtepu8_epi16(_mm256_loadu_si256((__m256i*) (b + j)));
+            __m512i difference = _mm512_sub_epi16(x, y);
+
+            sum = _mm512_add_epi32(sum, _mm512_madd_epi16(difference, difference));
+        }
+
+        for (; j + 16 <= size; j += 16)
+        {
+            __m256i x = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i*) (a + j)));
+            __m256i y = _mm256_cvtepu8_epi16(_mm_loadu_si128((__m128i*) (b + j)));
+            __m256i difference = _mm256_sub_epi16(x, y);
+
+            sum_half = _mm256_add_epi32(sum_half, _mm256_madd_epi16(difference, difference));
+        }
+
+        for (; j + 8 <= size; j += 8)
+        {
+            __m128i x = _mm_cvtepu8_epi16(_mm_loadl_epi64((__m128i*) (a + j)));
+            __m128i y = _mm_cvtepu8_epi16(_mm_loadl_epi64((__m128i*) (b + j)));
+            __m128i difference = _mm_sub_epi16(x, y);
+
+            sum_quarter = _mm_add_epi32(sum_quarter, _mm_madd_epi16(difference, difference));
+        }
+
+        // Remaining pixels of the row
+        for (; j < size; j++)
+        {
+            int difference = (int) a[j] - (int) b[j];
+
+            ssd += difference*difference;
+        }
+    }
+
+    // Horizontal sum of the lanes
+    ssd += (uint32_t) _mm512_reduce_add_epi32(sum);
+    sum_quarter = _mm_add_epi32(sum_quarter, _mm256_castsi256_si128(sum_half));
+    sum_quarter = _mm_add_epi32(sum_quarter, _mm256_extracti128_si256(sum_half, 1));
+    sum_quarter = _mm_hadd_epi32(sum_quarter, sum_quarter);
+    sum_quarter = _mm_hadd_epi32(sum_quarter, sum_quarter);
+
+    return ssd + (uint32_t) _mm_cvtsi128_si32(sum_quarter);
+}
+#endif
+
+// Kernels specialized for windows of size x size, the size is a
+// constant so the loops are fully unrolled. They fall back to the
+// generic kernels for other sizes
+#define DEFINE_NLM_KERNELS_SIZED(isa, target, size)                          \
+    target uint32_t patch_ssd_##isa##_##size(uint8_t* v, uint8_t* u,         \
+                                             int width, int window_size)     \
+    {                                                                        \
+        if (window_size != size)                                             \
+        {                                                                    \
+            return patch_ssd_##isa(v, u, width, window_size);                \
+        }                                                                    \
+                                                                             \
+        return patch_ssd(v, u, width, size);                                 \
+    }
+
+// Specializations of the instruction set variants of patch_ssd
+#define DEFINE_NLM_KERNELS(isa, target)                                      \
+    FOR_EACH_SPECIALIZED_SIZE(DEFINE_NLM_KERNELS_SIZED, isa, target)
+
+DEFINE_NLM_KERNELS(scalar, TARGET_SCALAR)
+#ifdef HAVE_X86_SIMD
+DEFINE_NLM_KERNELS(sse2, TARGET_SSE2)
+DEFINE_NLM_KERNELS(avx2, TARGET_AVX2)
+DEFINE_NLM_KERNELS(avx512, TARGET_AVX512)
+#endif
+
+// Maximum number of entries of the weight table
+#define WEIGHT_LUT_MAX_SIZE 65536
+
+/**
+ * Table of the similarity weights exp(-distance/stdev^2), sampled
+ * every 1/scale of distance from 0 to the largest distance between two
+ * windows.
+ */
+typedef struct
+{
+    double* weights;
+    // Samples per unit of distance, a power of two
+    double scale;
+    int size;
+} weight_lut_t;
+
+/**
+ * This function fills the table of similarity weights for windows of
+ * size x size. The distance between two windows of 8 bit pixels is at
+ * most 255*window_size, the step is the smallest power of two that
+ * keeps the table under WEIGHT_LUT_MAX_SIZE entries.
+ *
+ * Params:
+ *      weight_lut_t* lut - pointer to store the table.
+ *      int window_size - size of the window.
+ *      double stdev - standard deviation of the gaussian
+ *                     distribution.
+ */
+void build_weight_lut(weight_lut_t* lut, int window_size, double stdev)
+{
+    double max_distance = 255.0*window_size;
+    double variance = pow(stdev, 2.0);
+
+    lut->scale = 1.0;
+
+    while (max_distance*lut->scale*2 + 2 <= WEIGHT_LUT_MAX_SIZE)
+    {
+        lut->scale *= 2;
+    }
+
+    while (lut->scale > 1.0/256 && max_distance*lut->scale + 2 > WEIGHT_LUT_MAX_SIZE)
+    {
+        lut->scale /= 2;
+    }
+
+    // One more entry for the interpolation of the last sample
+    lut->size = (int) ceil(max_distance*lut->scale) + 2;
+    lut->weights = (double*) calloc(lut->size, sizeof(double));
+
+    if (lut->weights == NULL)
+    {
+        printf("Unable to allocate memory for the weight table.\n");
+        exit(1);
+    }
+
+    for (int k = 0; k < lut->size; k++)
+    {
+        lut->weights[k] = exp(-(k/lut->scale)/variance);
+    }
+}
+
+/**
+ * This function returns the similarity weight of a distance,
+ * interpolated linearly between the two nearest samples of the table.
+ *
+ * Params:
+ *      weight_lut_t* lut - table of weights.
+ *      double distance - distance between the windows.
+ *
+ * Returns:
+ *      double - weight of the distance.
+ */
+INLINE_KERNEL double lookup_weight(weight_lut_t* lut, double distance)
+{
+    double position = distance*lut->scale;
+    int index = (int) position;
+    double fraction = position - index;
+
+    return lut->weights[index] + fraction*(lut->weights[index + 1] - lut->weights[index]);
+}
+
+/**
+ * This function returns the similarity weight of a distance, from the
+ * table if there is one or from exp otherwise.
+ *
+ * Params:
+ *      weight_lut_t* lut - table of weights or NULL.
+ *      double distance - distance between the windows.
+ *      double variance - square of the standard deviation.
+ *
+ * Returns:
+ *      double - weight of the distance.
+ */
+INLINE_KERNEL double get_similarity(weight_lut_t* lut, double distance,
+                                    double variance)
+{
+    if (lut != NULL)
+    {
+        return lookup_weight(lut, distance);
+    }
+
+    return exp(-distance/variance);
+}
+
+/**
+ * This function prints the largest absolute and relative errors of the
+ * weight table against exp for every distance two windows of size x
+ * size can have.
+ *
+ * Params:
+ *      int window_size - size of the window.
+ *      double stdev - standard deviation of the gaussian
+ *                     distribution.
+ */
+void print_lut_error(int window_size, double stdev)
+{
+    weight_lut_t lut;
+    double variance = pow(stdev, 2.0);
+    double max_abs_error = 0.0;
+    double max_rel_error = 0.0;
+
+    build_weight_lut(&lut, window_size, stdev);
+
+    // Every sum of squared differences between two windows
+    uint64_t max_ssd = (uint64_t) window_size*window_size*255*255;
+
+    for (uint64_t ssd = 0; ssd <= max_ssd; ssd++)
+    {
+        double distance = sqrt((double) ssd);
+        double exact = exp(-distance/variance);
+        double error = fabs(lookup_weight(&lut, distance) - exact);
+
+        max_abs_error = MAX(max_abs_error, error);
+
+        if (exact > 0)
+        {
+            max_rel_error = MAX(max_rel_error, error/exact);
+        }
+    }
+
+    printf("Weight table: %d entries, step 1/%g, max error %.3e, max relative error %.3e\n",
+           lut.size, lut.scale, max_abs_error, max_rel_error);
+
+    free(lut.weights);
+}
+
+/**
+ * Thresholds of the pre-selection of the candidates by the mean and
+ * the variance of their windows.
+ */
+typedef struct
+{
+    // Largest difference between the means of the windows
+    double mean_threshold;
+    // Largest ratio between the variances of the windows
+    double variance_ratio;
+} nlm_preselect_t;
+
+/**
+ * Band of rows filtered by a thread, with the arguments of the filter
+ * and the scratch buffers the thread owns.
+ */
+typedef struct
+{
+    uint8_t* img;
+    uint8_t* filtered;
+    int width;
+    int height;
+    int window_size;
+    int sim_window_size;
+    double variance;
+    // Table of weights or NULL to use exp
+    weight_lut_t* lut;
+    // First row of the band and row after the last one
+    int row_begin;
+    int row_end;
+    // Accumulators of the filters that add weights to pixels out of
+    // the band, they cover accumulator_rows rows from accumulator_begin
+    double* sums;
+    double* normalization_factors;
+    int accumulator_begin;
+    int accumulator_rows;
+    // Side of the tiles of nlm_filter_tiled
+    int tile_size;
+    // Distance between the centers of the grid of nlm_filter_blockwise
+    int step;
+    // Statistics of the windows and thresholds of the pre-selection,
+    // NULL to compare every candidate
+    double* means;
+    double* variances;
+    nlm_preselect_t* preselect;
+    // Candidates compared and rejected by the pre-selection
+    long candidates;
+    long rejected;
+    // Squared standard deviations, weight tables (NULL to use exp) and
+    // filtered images of nlm_filter_sigmas, one per standard deviation
+    double* sigma_variances;
+    weight_lut_t* sigma_luts;
+    uint8_t** sigma_filtered;
+    int sigmas;
+    // PCA descriptors of the windows of nlm_filter_pca, dims values
+    // per pixel
+    float* descriptors;
+    int dims;
+    // Offsets weighted for every pixel by nlm_filter_patchmatch
+    int neighbors;
+} nlm_band_t;
+
+/**
+ * This function splits the rows of [row_begin, row_end) whose window is
+ * inside of the image in bands of about the same size and filters each
+ * band in its own thread.
+ *
+ * Params:
+ *      void* (*worker)(void*) - function that filters a band.
+ *      nlm_band_t* bands - pointer to store the bands, one per thread.
+ *                          The first one holds the arguments of the
+ *                          filter.
+ *      int row_begin - first row to filter.
+ *      int row_end - row after the last row to filter.
+ *      int threads - number of threads.
+ */
+void run_bands(void* (*worker)(void*), nlm_band_t* bands, int row_begin,
+               int row_end, int threads)
+{
+    // Get the middle of the window
+    int mid_window = (int) (bands[0].window_size - 1)/2;
+
+    // Rows to filter whose window is inside of the image
+    int first = MAX(row_begin, mid_window);
+    int last = MIN(row_end, bands[0].height - bands[0].window_size + mid_window + 1);
+    int rows = MAX(last - first, 0);
+
+    // The first band is the last one updated, the others copy it
+    for (int t = threads - 1; t >= 0; t--)
+    {
+        bands[t] = bands[0];
+        bands[t].row_begin = first + (int) ((long) rows*t/threads);
+        bands[t].row_end = first + (int) ((long) rows*(t + 1)/threads);
+    }
+
+    if (threads < 2)
+    {
+        worker(&bands[0]);
+        return;
+    }
+
+    pthread_t* ids = (pthread_t*) calloc(threads, sizeof(pthread_t));
+
+    if (ids == NULL)
+    {
+        printf("Unable to allocate memory for the threads.\n");
+        exit(1);
+    }
+
+    for (int t = 0; t < threads; t++)
+    {
+        if (pthread_create(&ids[t], NULL, worker, &bands[t]) != 0)
+        {
+            printf("Unable to create the thread %d.\n", t);
+            exit(1);
+        }
+    }
+
+    for (int t = 0; t < threads; t++)
+    {
+        pthread_join(ids[t], NULL);
+    }
+
+    free(ids);
+}
+
+/**
+ * This function computes the non-local means value of a pixel, window
+ * by window.
+ *
+ * Params:
+ *      nlm_band_t* band - band with the arguments of the filter.
+ *      int i - row of the pixel.
+ *      int j - column of the pixel.
+ *
+ * Returns:
+ *      uint8_t - filtered value of the pixel.
+ */
+INLINE_KERNEL uint8_t nlm_pixel(nlm_band_t* band, int i, int j)
+{
+    uint8_t* img = band->img;
+    int width = band->width;
+    int height = band->height;
+    int window_size = band->window_size;
+
+    // Get the middle of the windows
+    int mid_window = (int) (window_size - 1)/2;
+    int mid_sim_window = (int) (band->sim_window_size - 1)/2;
+
+    // Last row and column whose window is inside of the image
+    int last_row = height - window_size + mid_window;
+    int last_col = width - window_size + mid_window;
+
+    double sum = 0.0;
+
+    // Top left pixel of the window
+    uint8_t* window = img + (i - mid_window)*width + j - mid_window;
+
+    // Values for the similarity window
+    int umin = MAX(i - mid_sim_window, mid_window);
+    int umax = MIN(i + mid_sim_window, last_row);
+    int vmin = MAX(j - mid_sim_window, mid_window);
+    int vmax = MIN(j + mid_sim_window, last_col);
+
+    double normalization_factor = 0.0;
+
+    // Compare window against the similarity window
+    for (int u = umin; u < umax + 1; u++)
+    {
+        for (int v = vmin; v < vmax + 1; v++)
+        {
+            if (band->preselect != NULL)
+            {
+                // Skip the candidates whose window has a different
+                // mean or variance without computing their distance
+                double mean_difference = fabs(band->means[i*width + j] - band->means[u*width + v]);
+                double variance_ratio = (band->variances[i*width + j] + 1.0)/(band->variances[u*width + v] + 1.0);
+
+                band->candidates++;
+
+                if (mean_difference > band->preselect->mean_threshold ||
+                    variance_ratio > band->preselect->variance_ratio ||
+                    variance_ratio*band->preselect->variance_ratio < 1.0)
+                {
+                    band->rejected++;
+                    continue;
+                }
+            }
+
+            // Top left pixel of the similarity window
+            uint8_t* sim_window = img + (u - mid_window)*width + v - mid_window;
+
+            // Similarity between pixels
+            double norm_value = sqrt((double) kernels.patch_ssd(window, sim_window, width, window_size));
+            double similarity = get_similarity(band->lut, norm_value, band->variance);
+
+            normalization_factor += similarity;
+            sum += similarity*img[u*width + v];
+        }
+    }
+
+    // Normalize the resulting pixel
+    double result = sum/normalization_factor;
+    uint8_t value = 0;
+
+    // Keep the pixel value between 0 and 255, avoiding
+    // unexpected values
+    if (result > 255)
+    {
+        value = 255;
+    } else if (result > 0)
+    {
+        value = (uint8_t) round(result);
+    }
+
+    return value;
+}
+
+/**
+ * This function performs a non-local means filtering on a band of rows
+ * of an image, window by window.
+ *
+ * Params:
+ *      void* arg - band to filter (nlm_band_t*).
+ *
+ * Returns:
+ *      void* - NULL.
+ */
+void* nlm_filter_band(void* arg)
+{
+    nlm_band_t* band = (nlm_band_t*) arg;
+    int width = band->width;
+
+    // Get the middle of the window
+    int mid_window = (int) (band->window_size - 1)/2;
+
+    // Last column whose window is inside of the image
+    int last_col = width - band->window_size + mid_window;
+
+    for (int i = band->row_begin; i < band->row_end; i++)
+    {
+        for (int j = mid_window; j < last_col + 1; j++)
+        {
+            band->filtered[i*width + j] = nlm_pixel(band, i, j);
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * This function computes the mean and the variance of the window
+ * centered on every pixel whose window is inside of the image. The
+ * sums of the pixels and of their squares come from two integral
+ * images, so the cost does not depend on the size of the window.
+ *
+ * Params:
+ *      uint8_t* img - image.
+ *      double* means - pointer to store the means.
+ *      double* variances - pointer to store the variances.
+ *      int width - number of cols.
+ *      int height - number of rows.
+ *      int window_size - size of the window.
+ */
+void get_window_statistics(uint8_t* img, double* means, double* variances,
+                           int width, int height, int window_size)
+{
+    // Get the middle of the window
+    int mid_window = (int) (window_size - 1)/2;
+
+    // Last row and column whose window is inside of the image
+    int last_row = height - window_size + mid_window;
+    int last_col = width - window_size + mid_window;
+
+    int stride = width + 1;
+    double pixels = window_size*window_size;
+
+    // Get memory for the integral images
+    uint64_t* sums = (uint64_t*) calloc((height + 1)*stride, sizeof(uint64_t));
+    uint64_t* squares = (uint64_t*) calloc((height + 1)*stride, sizeof(uint64_t));
+
+    if (sums == NULL || squares == NULL)
+    {
+        printf("Unable to allocate memory for the window statistics.\n");
+        exit(1);
+    }
+
+    for (int y = 0; y < height; y++)
+    {
+        uint64_t row_sum = 0;
+        uint64_t row_squares = 0;
+
+        for (int x = 0; x < width; x++)
+        {
+            uint64_t pixel = img[y*width + x];
+
+            row_sum += pixel;
+            row_squares += pixel*pixel;
+            sums[(y + 1)*stride + x + 1] = sums[y*stride + x + 1] + row_sum;
+            squares[(y + 1)*stride + x + 1] = squares[y*stride + x + 1] + row_squares;
+        }
+    }
+
+    for (int i = mid_window; i < last_row + 1; i++)
+    {
+        int top = (i - mid_window)*stride;
+        int bottom = top + window_size*stride;
+
+        for (int j = mid_window; j < last_col + 1; j++)
+        {
+            int left = j - mid_window;
+            int right = left + window_size;
+
+            double sum = sums[bottom + right] - sums[bottom + left] - sums[top + right] + sums[top + left];
+            double square = squares[bottom + right] - squares[bottom + left] - squares[top + right] + squares[top + left];
+            double mean = sum/pixels;
+
+            means[i*width + j] = mean;
+            variances[i*width + j] = square/pixels - mean*mean;
+        }
+    }
+
+    // Free memory
+    free(sums);
+    free(squares);
+}
+
+/**
+ * This function performs a non-local means filtering on an image,
+ * window by window, with the worker given. If there are pre-selection
+ * thresholds, the candidates whose window has a different mean or
+ * variance are skipped and the rate of skipped candidates is printed.
+ *
+ * Params:
+ *      void* (*worker)(void*) - function that filters a band.
+ *      int tile_size - side of the tiles of the worker, if it uses
+ *                      them.
+ *      uint8_t* img - image to filter.
+ *      uint8_t* filtered - pointer to the filtered image.
+ *      int width - number of cols.
+ *      int height - number of rows.
+ *      int row_begin - first row to filter.
+ *      int row_end - row after the last row to filter.
+ *      int window_size - size of the window.
+ *      int sim_window_size - size of the similarity window.
+ *      double stdev - standard deviation of the gaussian
+ *                     distribution.
+ *      int use_lut - take the weights from a table instead of exp.
+ *      nlm_preselect_t* preselect - thresholds of the pre-selection or
+ *                                   NULL to compare every candidate.
+ *      int threads - number of threads, each one filters a band of
+ *                    rows.
+ */
+void nlm_filter_windows(void* (*worker)(void*), int tile_size, uint8_t* img,
+                        uint8_t* filtered, int width, int height,
+                        int row_begin, int row_end, int window_size,
+                        int sim_window_size, double stdev, int use_lut,
+                        nlm_preselect_t* preselect, int threads)
+{
+    nlm_band_t* bands = (nlm_band_t*) calloc(threads, sizeof(nlm_band_t));
+    weight_lut_t lut;
+
+    if (bands == NULL)
+    {
+        printf("Unable to allocate memory for the bands.\n");
+        exit(1);
+    }
+
+    if (use_lut)
+    {
+        build_weight_lut(&lut, window_size, stdev);
+    }
+
+    bands[0] = (nlm_band_t) {.img = img, .filtered = filtered, .width = width,
+                             .height = height, .window_size = window_size,
+                             .sim_window_size = sim_window_size,
+                             .variance = pow(stdev, 2.0),
+                             .lut = use_lut ? &lut : NULL,
+                             .tile_size = tile_size};
+
+    if (preselect != NULL)
+    {
+        // Get memory for the statistics of the windows
+        bands[0].means = (double*) calloc(width*height, sizeof(double));
+        bands[0].variances = (double*) calloc(width*height, sizeof(double));
+        bands[0].preselect = preselect;
+
+        if (bands[0].means == NULL || bands[0].variances == NULL)
+        {
+            printf("Unable to allocate memory for the window statistics.\n");
+            exit(1);
+        }
+
+        get_window_statistics(img, bands[0].means, bands[0].variances, width, height, window_size);
+    }
+
+    run_bands(worker, bands, row_begin, row_end, threads);
+
+    if (preselect != NULL)
+    {
+        long candidates = 0;
+        long rejected = 0;
+
+        for (int t = 0; t < threads; t++)
+        {
+            candidates += bands[t].candidates;
+            rejected += bands[t].rejected;
+        }
+
+        printf("Pre-selection rejected %ld of %ld candidates (%.2f%%).\n", rejected, candidates,
+               candidates > 0 ? 100.0*rejected/candidates : 0.0);
+
+        free(bands[0].means);
+        free(bands[0].variances);
+    }
+
+    // Free memory
+    free(bands);
+
+    if (use_lut)
+    {
+        free(lut.weights);
+    }
+}
+
+/**
+ * This function performs a non-local means filtering on an image.
+ *
+ * Params:
+ *      uint8_t* img - image to filter.
+ *      uint8_t* filtered - pointer to the filtered image.
+ *      int width - number of cols.
+ *      int height - number of rows.
+ *      int row_begin - first row to filter.
+ *      int row_end - row after the last row to filter.
+ *      int window_size - size of the window.
+ *      int sim_window_size - size of the similarity window.
+ *      double stdev - standard deviation of the gaussian
+ *                     distribution.
+ *      int use_lut - take the weights from a table instead of exp.
+ *      nlm_preselect_t* preselect - thresholds of the pre-selection or
+ *                                   NULL to compare every candidate.
+ *      int threads - number of threads, each one filters a band of
+ *                    rows.
+ */
+void nlm_filter(uint8_t* img, uint8_t* filtered, int width, int height,
+                int row_begin, int row_end, int window_size,
+                int sim_window_size, double stdev, int use_lut,
+                nlm_preselect_t* preselect, int threads)
+{
+    nlm_filter_windows(nlm_filter_band, 0, img, filtered, width, height, row_begin, row_end, window_size, sim_window_size, stdev, use_lut, preselect, threads);
+}
+
+/**
+ * This function returns the side of the square tiles of
+ * nlm_filter_tiled. The pixels a tile reads, the tile and the radius
+ * of the windows around it, take at most half of the L1 data cache of
+ * the CPU. The rows a row of pixels reads already fit in L2 at usual
+ * widths, so only tiles that fit in L1 save misses.
+ *
+ * Params:
+ *      int window_size - size of the window.
+ *      int sim_window_size - size of the similarity window.
+ *
+ * Returns:
+ *      int - side of the tiles.
+ */
+int get_tile_size(int window_size, int sim_window_size)
+{
+    long l1_size = -1;
+
+#ifdef _SC_LEVEL1_DCACHE_SIZE
+    l1_size = sysconf(_SC_LEVEL1_DCACHE_SIZE);
+#endif
+
+    // Most CPUs have at least 32 KB of L1 data cache
+    if (l1_size <= 0)
+    {
+        l1_size = 32*1024;
+    }
+
+    // Rows and columns read around a tile
+    int radius = (window_size - 1)/2 + (sim_window_size - 1)/2;
+    int footprint = (int) sqrt(l1_size/2.0);
+
+    return MAX(footprint - 2*radius, 16);
+}
+
+/**
+ * This function performs a non-local means filtering on a band of rows
+ * of an image, window by window, visiting the band in square tiles so
+ * the pixels read by a tile are loaded in cache once.
+ *
+ * Params:
+ *      void* arg - band to filter (nlm_band_t*).
+ *
+ * Returns:
+ *      void* - NULL.
+ */
+void* nlm_filter_tiled_band(void* arg)
+{
+    nlm_band_t* band = (nlm_band_t*) arg;
+    int width = band->width;
+    int tile_size = band->tile_size;
+
+    // Get the middle of the window
+    int mid_window = (int) (band->window_size - 1)/2;
+
+    // Last column whose window is inside of the image
+    int last_col = width - band->window_size + mid_window;
+
+    for (int ti = band->row_begin; ti < band->row_end; ti += tile_size)
+    {
+        for (int tj = mid_window; tj < last_col + 1; tj += tile_size)
+        {
+            int imax = MIN(ti + tile_size, band->row_end);
+            int jmax = MIN(tj + tile_size, last_col + 1);
+
+            for (int i = ti; i < imax; i++)
+            {
+                for (int j = tj; j < jmax; j++)
+                {
+                    band->filtered[i*width + j] = nlm_pixel(band, i, j);
+                }
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * This function performs a non-local means filtering on an image like
+ * nlm_filter, but every band of rows is visited in square tiles sized
+ * with get_tile_size. The result is the same as nlm_filter.
+ *
+ * Params:
+ *      uint8_t* img - image to filter.
+ *      uint8_t* filtered - pointer to the filtered image.
+ *      int width - number of cols.
+ *      int height - number of rows.
+ *      int row_begin - first row to filter.
+ *      int row_end - row after the last row to filter.
+ *      int window_size - size of the window.
+ *      int sim_window_size - size of the similarity window.
+ *      double stdev - standard deviation of the gaussian
+ *                     distribution.
+ *      int use_lut - take the weights from a table instead of exp.
+ *      nlm_preselect_t* preselect - thresholds of the pre-selection or
+ *                                   NULL to compare every candidate.
+ *      int threads - number of threads, each one filters a band of
+ *                    rows.
+ */
+void nlm_filter_tiled(uint8_t* img, uint8_t* filtered, int width, int height,
+                      int row_begin, int row_end, int window_size,
+                      int sim_window_size, double stdev, int use_lut,
+                      nlm_preselect_t* preselect, int threads)
+{
+    int tile_size = get_tile_size(window_size, sim_window_size);
+
+    nlm_filter_windows(nlm_filter_tiled_band, tile_size, img, filtered, width, height, row_begin, row_end, window_size, sim_window_size, stdev, use_lut, preselect, threads);
+}
+
+/**
+ * This function computes the integral image of the squared differences
+ * between rows of an image and the same rows shifted by (du, dv), pixel
+ * (y, x) is compared against pixel (y + du, x + dv). The pixels whose
+ * shifted pixel falls outside of the image add zero.
+ *
+ * Params:
+ *      uint8_t* img - image.
+ *      uint64_t* integral - pointer to store the integral image, it
+ *                           has (rows + 1) x (width + 1) elements and
+ *                           its first row must be zero.
+ *      int width - number of cols.
+ *      int height - number of rows.
+ *      int first_row - first row of the image to sum.
+ *      int rows - number of rows to sum.
+ *      int du - vertical offset.
+ *      int dv - horizontal offset.
+ */
+void get_ssd_integral(uint8_t* img, uint64_t* integral, int width,
+                      int height, int first_row, int rows, int du, int dv)
+{
+    int stride = width + 1;
+
+    // Columns whose shifted pixel is inside the image, none when the
+    // offset is as large as the image
+    int xmin = MIN(MAX(0, -dv), width);
+    int xmax = MAX(MIN(width, width - dv), 0);
+
+    for (int k = 0; k < rows; k++)
+    {
+        int y = first_row + k;
+        uint64_t* previous = integral + k*stride;
+        uint64_t* current = integral + (k + 1)*stride;
+        uint64_t row_sum = 0;
+
+        current[0] = 0;
+
+        if (y + du < 0 || y + du >= height)
+        {
+            // The shifted row is outside of the image
+            memcpy(current + 1, previous + 1, width*sizeof(uint64_t));
+            continue;
+        }
+
+        uint8_t* row = img + y*width;
+        uint8_t* shifted = img + (y + du)*width + dv;
+
+        for (int x = 0; x < xmin; x++)
+        {
+            current[x + 1] = previous[x + 1];
+        }
+
+        for (int x = xmin; x < xmax; x++)
+        {
+            int difference = (int) row[x] - (int) shifted[x];
+
+            row_sum += difference*difference;
+            current[x + 1] = previous[x + 1] + row_sum;
+        }
+
+        for (int x = xmax; x < width; x++)
+        {
+            current[x + 1] = previous[x + 1] + row_sum;
+        }
+    }
+}
+
+/**
+ * This function divides the weighted sum of every pixel of some rows by
+ * the sum of its weights and stores the result in the filtered image.
+ * Only the columns whose window is inside of the image are set.
+ *
+ * Params:
+ *      double* sums - weighted sums of the candidates of the first
+ *                     row.
+ *      double* normalization_factors - sums of the weights of the
+ *                                      first row.
+ *      uint8_t* filtered - pointer to the first row of the filtered
+ *                          image.
+ *      int width - number of cols.
+ *      int rows - number of rows.
+ *      int window_size - size of the window.
+ */
+void normalize_accumulators(double* sums, double* normalization_factors,
+                            uint8_t* filtered, int width, int rows,
+                            int window_size)
+{
+    // Get the middle of the window
+    int mid_window = (int) (window_size - 1)/2;
+
+    // Last column whose window is inside of the image
+    int last_col = width - window_size + mid_window;
+
+    for (int i = 0; i < rows; i++)
+    {
+        for (int j = mid_window; j < last_col + 1; j++)
+        {
+            // Normalize the resulting pixel
+            double result = sums[i*width + j]/normalization_factors[i*width + j];
+            uint8_t value = 0;
+
+            // Keep the pixel value between 0 and 255, avoiding
+            // unexpected values
+            if (result > 255)
+            {
+                value = 255;
+            } else if (result > 0)
+            {
+                value = (uint8_t) round(result);
+            }
+
+            filtered[i*width + j] = value;
+        }
+    }
+}
+
+/**
+ * This function adds the accumulators of every band to the
+ * accumulators of the image, in the order of the bands, and frees
+ * them.
+ *
+ * Params:
+ *      nlm_band_t* bands - bands with their accumulators.
+ *      int threads - number of bands.
+ *      double* sums - weighted sums of the candidates of every pixel.
+ *      double* normalization_factors - sums of the weights of every
+ *                                      pixel.
+ *      int width - number of cols.
+ */
+void merge_band_accumulators(nlm_band_t* bands, int threads, double* sums,
+                             double* normalization_factors, int width)
+{
+    for (int t = 0; t < threads; t++)
+    {
+        int first = bands[t].accumulator_begin*width;
+
+        for (int k = 0; k < bands[t].accumulator_rows*width; k++)
+        {
+            sums[first + k] += bands[t].sums[k];
+            normalization_factors[first + k] += bands[t].normalization_factors[k];
+        }
+
+        free(bands[t].sums);
+        free(bands[t].normalization_factors);
+    }
+}
+
+/**
+ * This function performs a non-local means filtering on a band of rows
+ * of an image offset by offset. For every displacement of the
+ * similarity window the squared differences against the shifted image
+ * are summed once in an integral image of the rows the band reads.
+ *
+ * Params:
+ *      void* arg - band to filter (nlm_band_t*).
+ *
+ * Returns:
+ *      void* - NULL.
+ */
+void* nlm_filter_integral_band(void* arg)
+{
+    nlm_band_t* band = (nlm_band_t*) arg;
+    uint8_t* img = band->img;
+    int width = band->width;
+    int height = band->height;
+    int window_size = band->window_size;
+    int rows = band->row_end - band->row_begin;
+
+    if (rows <= 0)
+    {
+        return NULL;
+    }
+
+    // Get the middle of the windows
+    int mid_window = (int) (window_size - 1)/2;
+    int mid_sim_window = (int) (band->sim_window_size - 1)/2;
+
+    // Last row and column whose window is inside of the image
+    int last_row = height - window_size + mid_window;
+    int last_col = width - window_size + mid_window;
+
+    // The windows of the band cover rows + window_size - 1 rows
+    int first_row = band->row_begin - mid_window;
+    int integral_rows = rows + window_size - 1;
+    int stride = width + 1;
+
+    // Get memory for the integral image and the accumulators of the
+    // band
+    uint64_t* integral = (uint64_t*) calloc((integral_rows + 1)*stride, sizeof(uint64_t));
+    double* sums = (double*) calloc(rows*width, sizeof(double));
+    double* normalization_factors = (double*) calloc(rows*width, sizeof(double));
+
+    if (integral == NULL || sums == NULL || normalization_factors == NULL)
+    {
+        printf("Unable to allocate memory for the integral image.\n");
+        exit(1);
+    }
+
+    for (int du = -mid_sim_window; du < mid_sim_window + 1; du++)
+    {
+        for (int dv = -mid_sim_window; dv < mid_sim_window + 1; dv++)
+        {
+            get_ssd_integral(img, integral, width, height, first_row, integral_rows, du, dv);
+
+            // Pixels whose candidate (i + du, j + dv) has its window
+            // inside of the image
+            int imin = MAX(band->row_begin, mid_window - du);
+            int imax = MIN(band->row_end - 1, last_row - du);
+            int jmin = MAX(mid_window, mid_window - dv);
+            int jmax = MIN(last_col, last_col - dv);
+
+            for (int i = imin; i < imax + 1; i++)
+            {
+                uint64_t* top = integral + (i - mid_window - first_row)*stride - mid_window;
+                uint64_t* bottom = top + window_size*stride;
+                uint8_t* candidates = img + (i + du)*width + dv;
+                double* row_sums = sums + (i - band->row_begin)*width;
+                double* row_factors = normalization_factors + (i - band->row_begin)*width;
+
+                for (int j = jmin; j < jmax + 1; j++)
+                {
+                    // Sum of squares of the difference between the
+                    // windows
+                    uint64_t ssd = bottom[j + window_size] - bottom[j] - top[j + window_size] + top[j];
+
+                    // Similarity between pixels
+                    double similarity = get_similarity(band->lut, sqrt((double) ssd), band->variance);
+
+                    row_factors[j] += similarity;
+                    row_sums[j] += similarity*candidates[j];
+                }
+            }
+        }
+    }
+
+    // Normalize the resulting pixels
+    normalize_accumulators(sums, normalization_factors, band->filtered + band->row_begin*width, width, rows, window_size);
+
+    // Free memory
+    free(integral);
+    free(sums);
+    free(normalization_factors);
+
+    return NULL;
+}
+
+/**
+ * This function performs a non-local means filtering on an image
+ * offset by offset. For every displacement of the similarity window
+ * the squared differences against the shifted image are summed once in
+ * an integral image, so the distance between two windows takes four
+ * lookups whatever the size of the window. The candidates and the
+ * order in which they are accumulated are the same as in nlm_filter,
+ * so the result is the same.
+ *
+ * Params:
+ *      uint8_t* img - image to filter.
+ *      uint8_t* filtered - pointer to the filtered image.
+ *      int width - number of cols.
+ *      int height - number of rows.
+ *      int row_begin - first row to filter.
+ *      int row_end - row after the last row to filter.
+ *      int window_size - size of the window.
+ *      int sim_window_size - size of the similarity window.
+ *      double stdev - standard deviation of the gaussian
+ *                     distribution.
+ *      int use_lut - take the weights from a table instead of exp.
+ *      int threads - number of threads, each one filters a band of
+ *                    rows.
+ */
+void nlm_filter_integral(uint8_t* img, uint8_t* filtered, int width,
+                         int height, int row_begin, int row_end,
+                         int window_size, int sim_window_size, double stdev,
+                         int use_lut, int threads)
+{
+    nlm_band_t* bands = (nlm_band_t*) calloc(threads, sizeof(nlm_band_t));
+    weight_lut_t lut;
+
+    if (bands == NULL)
+    {
+        printf("Unable to allocate memory for the bands.\n");
+        exit(1);
+    }
+
+    if (use_lut)
+    {
+        build_weight_lut(&lut, window_size, stdev);
+    }
+
+    bands[0] = (nlm_band_t) {.img = img, .filtered = filtered, .width = width,
+                             .height = height, .window_size = window_size,
+                             .sim_window_size = sim_window_size,
+                             .variance = pow(stdev, 2.0),
+                             .lut = use_lut ? &lut : NULL};
+
+    run_bands(nlm_filter_integral_band, bands, row_begin, row_end, threads);
+
+    // Free memory
+    free(bands);
+
+    if (use_lut)
+    {
+        free(lut.weights);
+    }
+}
+
+/**
+ * This function performs a non-local means filtering on a band of rows
+ * of an image like nlm_filter_integral_band, but the weights and the
+ * accumulators are kept in single precision.
+ *
+ * Params:
+ *      void* arg - band to filter (nlm_band_t*).
+ *
+ * Returns:
+ *      void* - NULL.
+ */
+void* nlm_filter_float_band(void* arg)
+{
+    nlm_band_t* band = (nlm_band_t*) arg;
+    uint8_t* img = band->img;
+    int width = band->width;
+    int height = band->height;
+    int window_size = band->window_size;
+    int rows = band->row_end - band->row_begin;
+    float variance = (float) band->variance;
+
+    if (rows <= 0)
+    {
+        return NULL;
+    }
+
+    // Get the middle of the windows
+    int mid_window = (int) (window_size - 1)/2;
+    int mid_sim_window = (int) (band->sim_window_size - 1)/2;
+
+    // Last row and column whose window is inside of the image
+    int last_row = height - window_size + mid_window;
+    int last_col = width - window_size + mid_window;
+
+    // The windows of the band cover rows + window_size - 1 rows
+    int first_row = band->row_begin - mid_window;
+    int integral_rows = rows + window_size - 1;
+    int stride = width + 1;
+
+    // Get memory for the integral image and the accumulators of the
+    // band
+    uint64_t* integral = (uint64_t*) calloc((integral_rows + 1)*stride, sizeof(uint64_t));
+    float* sums = (float*) calloc(rows*width, sizeof(float));
+    float* normalization_factors = (float*) calloc(rows*width, sizeof(float));
+
+    if (integral == NULL || sums == NULL || normalization_factors == NULL)
+    {
+        printf("Unable to allocate memory for the integral image.\n");
+        exit(1);
+    }
+
+    for (int du = -mid_sim_window; du < mid_sim_window + 1; du++)
+    {
+        for (int dv = -mid_sim_window; dv < mid_sim_window + 1; dv++)
+        {
+            get_ssd_integral(img, integral, width, height, first_row, integral_rows, du, dv);
+
+            // Pixels whose candidate (i + du, j + dv) has its window
+            // inside of the image
+            int imin = MAX(band->row_begin, mid_window - du);
+            int imax = MIN(band->row_end - 1, last_row - du);
+            int jmin = MAX(mid_window, mid_window - dv);
+            int jmax = MIN(last_col, last_col - dv);
+
+            for (int i = imin; i < imax + 1; i++)
+            {
+                uint64_t* top = integral + (i - mid_window - first_row)*stride - mid_window;
+                uint64_t* bottom = top + window_size*stride;
+                uint8_t* candidates = img + (i + du)*width + dv;
+                float* row_sums = sums + (i - band->row_begin)*width;
+                float* row_factors = normalization_factors + (i - band->row_begin)*width;
+
+                for (int j = jmin; j < jmax + 1; j++)
+                {
+                    // Sum of squares of the difference between the
+                    // windows
+                    uint64_t ssd = bottom[j + window_size] - bottom[j] - top[j + window_size] + top[j];
+                    float distance = sqrtf((float) ssd);
+
+                    // Similarity between pixels
+                    float similarity = band->lut != NULL ? (float) lookup_weight(band->lut, distance) : expf(-distance/variance);
+
+                    row_factors[j] += similarity;
+                    row_sums[j] += similarity*candidates[j];
+                }
+            }
+        }
+    }
+
+    // Normalize the resulting pixels
+    for (int i = 0; i < rows; i++)
+    {
+        for (int j = mid_window; j < last_col + 1; j++)
+        {
+            float result = sums[i*width + j]/normalization_factors[i*width + j];
+            uint8_t value = 0;
+
+            // Keep the pixel value between 0 and 255, avoiding
+            // unexpected values
+            if (result > 255)
+            {
+                value = 255;
+            } else if (result > 0)
+            {
+                value = (uint8_t) roundf(result);
+            }
+
+            band->filtered[(band->row_begin + i)*width + j] = value;
+        }
+    }
+
+    // Free memory
+    free(integral);
+    free(sums);
+    free(normalization_factors);
+
+    return NULL;
+}
+
+/**
+ * This function performs a non-local means filtering on an image like
+ * nlm_filter_integral, with the weights and the accumulators in single
+ * precision. The accumulators, which are read and written once per
+ * offset, take half of the memory, and the result only needs to be
+ * right to 8 bits.
+ *
+ * Params:
+ *      uint8_t* img - image to filter.
+ *      uint8_t* filtered - pointer to the filtered image.
+ *      int width - number of cols.
+ *      int height - number of rows.
+ *      int row_begin - first row to filter.
+ *      int row_end - row after the last row to filter.
+ *      int window_size - size of the window.
+ *      int sim_window_size - size of the similarity window.
+ *      double stdev - standard deviation of the gaussian
+ *                     distribution.
+ *      int use_lut - take the weights from a table instead of exp.
+ *      int threads - number of threads, each one filters a band of
+ *                    rows.
+ */
+void nlm_filter_float(uint8_t* img, uint8_t* filtered, int width, int height,
+                      int row_begin, int row_end, int window_size,
+                      int sim_window_size, double stdev, int use_lut,
+                      int threads)
+{
+    nlm_band_t* bands = (nlm_band_t*) calloc(threads, sizeof(nlm_band_t));
+    weight_lut_t lut;
+
+    if (bands == NULL)
+    {
+        printf("Unable to allocate memory for the bands.\n");
+        exit(1);
+    }
+
+    if (use_lut)
+    {
+        build_weight_lut(&lut, window_size, stdev);
+    }
+
+    bands[0] = (nlm_band_t) {.img = img, .filtered = filtered, .width = width,
+                             .height = height, .window_size = window_size,
+                             .sim_window_size = sim_window_size,
+                             .variance = pow(stdev, 2.0),
+                             .lut = use_lut ? &lut : NULL};
+
+    run_bands(nlm_filter_float_band, bands, row_begin, row_end, threads);
+
+    // Free memory
+    free(bands);
+
+    if (use_lut)
+    {
+        free(lut.weights);
+    }
+}
+
+/**
+ * This function performs a non-local means filtering on a band of rows
+ * of an image row by row. For every displacement of the similarity
+ * window the row is swept from left to right keeping the sum of squared
+ * differences of the columns of the window: moving one pixel adds the
+ * entering column and subtracts the leaving one.
+ *
+ * Params:
+ *      void* arg - band to filter (nlm_band_t*).
+ *
+ * Returns:
+ *      void* - NULL.
+ */
+void* nlm_filter_sweep_band(void* arg)
+{
+    nlm_band_t* band = (nlm_band_t*) arg;
+    uint8_t* img = band->img;
+    int width = band->width;
+    int height = band->height;
+    int window_size = band->window_size;
+
+    // Get the middle of the windows
+    int mid_window = (int) (window_size - 1)/2;
+    int mid_sim_window = (int) (band->sim_window_size - 1)/2;
+
+    // Last row and column whose window is inside of the image
+    int last_row = height - window_size + mid_window;
+    int last_col = width - window_size + mid_window;
+
+    // Get memory for the column sums and the accumulators of a row
+    uint32_t* columns = (uint32_t*) calloc(width, sizeof(uint32_t));
+    double* sums = (double*) calloc(width, sizeof(double));
+    double* normalization_factors = (double*) calloc(width, sizeof(double));
+
+    if (columns == NULL || sums == NULL || normalization_factors == NULL)
+    {
+        printf("Unable to allocate memory for the column sums.\n");
+        exit(1);
+    }
+
+    for (int i = band->row_begin; i < band->row_end; i++)
+    {
+        memset(sums, 0, width*sizeof(double));
+        memset(normalization_factors, 0, width*sizeof(double));
+
+        // Candidate rows whose window is inside of the image
+        int dumin = MAX(-mid_sim_window, mid_window - i);
+        int dumax = MIN(mid_sim_window, last_row - i);
+
+        for (int du = dumin; du < dumax + 1; du++)
+        {
+            for (int dv = -mid_sim_window; dv < mid_sim_window + 1; dv++)
+            {
+                // Pixels whose candidate (i + du, j + dv) has its
+                // window inside of the image
+                int jmin = MAX(mid_window, mid_window - dv);
+                int jmax = MIN(last_col, last_col - dv);
+
+                if (jmin > jmax)
+                {
+                    continue;
+                }
+
+                // First row of the windows
+                uint8_t* window = img + (i - mid_window)*width;
+                uint8_t* sim_window = window + du*width + dv;
+                uint8_t* candidates = img + (i + du)*width + dv;
+                uint32_t ssd = 0;
+
+                for (int j = jmin; j < jmax + 1; j++)
+                {
+                    // Column entering the window
+                    int c = j - mid_window + window_size - 1;
+                    int entering = j == jmin ? window_size : 1;
+
+                    for (; entering > 0; entering--, c--)
+                    {
+                        uint32_t column = 0;
+
+                        for (int m = 0; m < window_size; m++)
+                        {
+                            int difference = window[m*width + c] - sim_window[m*width + c];
+
+                            column += difference*difference;
+                        }
+
+                        columns[c] = column;
+                        ssd += column;
+                    }
+
+                    // Column leaving the window
+                    if (j > jmin)
+                    {
+                        ssd -= columns[j - mid_window - 1];
+                    }
+
+                    // Similarity between pixels
+                    double similarity = get_similarity(band->lut, sqrt((double) ssd), band->variance);
+
+                    normalization_factors[j] += similarity;
+                    sums[j] += similarity*candidates[j];
+                }
+            }
+        }
+
+        // Normalize the resulting pixels
+        normalize_accumulators(sums, normalization_factors, band->filtered + i*width, width, 1, window_size);
+    }
+
+    // Free memory
+    free(columns);
+    free(sums);
+    free(normalization_factors);
+
+    return NULL;
+}
+
+/**
+ * This function performs a non-local means filtering on an image
+ * sweeping its rows with running column sums, so the distance between
+ * two windows costs window_size operations instead of window_size^2.
+ * Unlike nlm_filter_integral, it only needs the sums of a row of
+ * columns. The candidates and the order in which they are accumulated
+ * are the same as in nlm_filter, so the result is the same.
+ *
+ * Params:
+ *      uint8_t* img - image to filter.
+ *      uint8_t* filtered - pointer to the filtered image.
+ *      int width - number of cols.
+ *      int height - number of rows.
+ *      int row_begin - first row to filter.
+ *      int row_end - row after the last row to filter.
+ *      int window_size - size of the window.
+ *      int sim_window_size - size of the similarity window.
+ *      double stdev - standard deviation of the gaussian
+ *                     distribution.
+ *      int use_lut - take the weights from a table instead of exp.
+ *      int threads - number of threads, each one filters a band of
+ *                    rows.
+ */
+void nlm_filter_sweep(uint8_t* img, uint8_t* filtered, int width, int height,
+                      int row_begin, int row_end, int window_size,
+                      int sim_window_size, double stdev, int use_lut,
+                      int threads)
+{
+    nlm_band_t* bands = (nlm_band_t*) calloc(threads, sizeof(nlm_band_t));
+    weight_lut_t lut;
+
+    if (bands == NULL)
+    {
+        printf("Unable to allocate memory for the bands.\n");
+        exit(1);
+    }
+
+    if (use_lut)
+    {
+        build_weight_lut(&lut, window_size, stdev);
+    }
+
+    bands[0] = (nlm_band_t) {.img = img, .filtered = filtered, .width = width,
+                             .height = height, .window_size = window_size,
+                             .sim_window_size = sim_window_size,
+                             .variance = pow(stdev, 2.0),
+                             .lut = use_lut ? &lut : NULL};
+
+    run_bands(nlm_filter_sweep_band, bands, row_begin, row_end, threads);
+
+    // Free memory
+    free(bands);
+
+    if (use_lut)
+    {
+        free(lut.weights);
+    }
+}
+
+/**
+ * This function performs a non-local means filtering on a band of rows
+ * of an image for several standard deviations, row by row like
+ * nlm_filter_sweep_band. Every distance is computed once and its weight
+ * for each standard deviation is added to the accumulators of that
+ * standard deviation, which only take a row each.
+ *
+ * Params:
+ *      void* arg - band to filter (nlm_band_t*).
+ *
+ * Returns:
+ *      void* - NULL.
+ */
+void* nlm_filter_sigmas_band(void* arg)
+{
+    nlm_band_t* band = (nlm_band_t*) arg;
+    uint8_t* img = band->img;
+    int width = band->width;
+    int height = band->height;
+    int window_size = band->window_size;
+    int sigmas = band->sigmas;
+
+    // Get the middle of the windows
+    int mid_window = (int) (window_size - 1)/2;
+    int mid_sim_window = (int) (band->sim_window_size - 1)/2;
+
+    // Last row and column whose window is inside of the image
+    int last_row = height - window_size + mid_window;
+    int last_col = width - window_size + mid_window;
+
+    // Get memory for the column sums and the accumulators of a row of
+    // every standard deviation
+    uint32_t* columns = (uint32_t*) calloc(width, sizeof(uint32_t));
+    double* sums = (double*) calloc(sigmas*width, sizeof(double));
+    double* normalization_factors = (double*) calloc(sigmas*width, sizeof(double));
+
+    if (columns == NULL || sums == NULL || normalization_factors == NULL)
+    {
+        printf("Unable to allocate memory for the column sums.\n");
+        exit(1);
+    }
+
+    for (int i = band->row_begin; i < band->row_end; i++)
+    {
+        memset(sums, 0, sigmas*width*sizeof(double));
+        memset(normalization_factors, 0, sigmas*width*sizeof(double));
+
+        // Candidate rows whose window is inside of the image
+        int dumin = MAX(-mid_sim_window, mid_window - i);
+        int dumax = MIN(mid_sim_window, last_row - i);
+
+        for (int du = dumin; du < dumax + 1; du++)
+        {
+            for (int dv = -mid_sim_window; dv < mid_sim_window + 1; dv++)
+            {
+                // Pixels whose candidate (i + du, j + dv) has its
+                // window inside of the image
+                int jmin = MAX(mid_window, mid_window - dv);
+                int jmax = MIN(last_col, last_col - dv);
+
+                if (jmin > jmax)
+                {
+                    continue;
+                }
+
+                // First row of the windows
+                uint8_t* window = img + (i - mid_window)*width;
+                uint8_t* sim_window = window + du*width + dv;
+                uint8_t* candidates = img + (i + du)*width + dv;
+                uint32_t ssd = 0;
+
+                for (int j = jmin; j < jmax + 1; j++)
+                {
+                    // Column entering the window
+                    int c = j - mid_window + window_size - 1;
+                    int entering = j == jmin ? window_size : 1;
+
+                    for (; entering > 0; entering--, c--)
+                    {
+                        uint32_t column = 0;
+
+                        for (int m = 0; m < window_size; m++)
+                        {
+                            int difference = window[m*width + c] - sim_window[m*width + c];
+
+                            column += difference*difference;
+                        }
+
+                        columns[c] = column;
+                        ssd += column;
+                    }
+
+                    // Column leaving the window
+                    if (j > jmin)
+                    {
+                        ssd -= columns[j - mid_window - 1];
+                    }
+
+                    double distance = sqrt((double) ssd);
+
+                    for (int s = 0; s < sigmas; s++)
+                    {
+                        // Similarity between pixels
+                        double similarity = get_similarity(band->sigma_luts == NULL ? NULL : &band->sigma_luts[s], distance, band->sigma_variances[s]);
+
+                        normalization_factors[s*width + j] += similarity;
+                        sums[s*width + j] += similarity*candidates[j];
+                    }
+                }
+            }
+        }
+
+        // Normalize the resulting pixels of every standard deviation
+        for (int s = 0; s < sigmas; s++)
+        {
+            normalize_accumulators(sums + s*width, normalization_factors + s*width, band->sigma_filtered[s] + i*width, width, 1, window_size);
+        }
+    }
+
+    // Free memory
+    free(columns);
+    free(sums);
+    free(normalization_factors);
+
+    return NULL;
+}
+
+/**
+ * This function performs a non-local means filtering on an image for
+ * several standard deviations at once. The distances between windows do
+ * not depend on the standard deviation, so they are swept once like in
+ * nlm_filter_sweep and only the weights are computed for each one.
+ * Each result is the same as the one of nlm_filter_integral with that
+ * standard deviation.
+ *
+ * Params:
+ *      uint8_t* img - image to filter.
+ *      uint8_t** filtered - pointers to the filtered images, one per
+ *                           standard deviation.
+ *      int width - number of cols.
+ *      int height - number of rows.
+ *      int window_size - size of the window.
+ *      int sim_window_size - size of the similarity window.
+ *      double* stdevs - standard deviations of the gaussian
+ *                       distribution.
+ *      int sigmas - number of standard deviations.
+ *      int use_lut - take the weights from a table per standard
+ *                    deviation instead of exp.
+ *      int threads - number of threads, each one filters a band of
+ *                    rows.
+ */
+void nlm_filter_sigmas(uint8_t* img, uint8_t** filtered, int width,
+                       int height, int window_size, int sim_window_size,
+                       double* stdevs, int sigmas, int use_lut, int threads)
+{
+    nlm_band_t* bands = (nlm_band_t*) calloc(threads, sizeof(nlm_band_t));
+    double* variances = (double*) calloc(sigmas, sizeof(double));
+    weight_lut_t* luts = (weight_lut_t*) calloc(sigmas, sizeof(weight_lut_t));
+
+    if (bands == NULL || variances == NULL || luts == NULL)
+    {
+        printf("Unable to allocate memory for the bands.\n");
+        exit(1);
+    }
+
+    for (int s = 0; s < sigmas; s++)
+    {
+        variances[s] = pow(stdevs[s], 2.0);
+
+        if (use_lut)
+        {
+            build_weight_lut(&luts[s], window_size, stdevs[s]);
+        }
+    }
+
+    bands[0] = (nlm_band_t) {.img = img, .filtered = filtered[0],
+                             .width = width, .height = height,
+                             .window_size = window_size,
+                             .sim_window_size = sim_window_size,
+                             .variance = variances[0],
+                             .sigma_variances = variances,
+                             .sigma_luts = use_lut ? luts : NULL,
+                             .sigma_filtered = filtered, .sigmas = sigmas};
+
+    run_bands(nlm_filter_sigmas_band, bands, 0, height, threads);
+
+    // Free memory
+    free(bands);
+    free(variances);
+
+    for (int s = 0; s < sigmas && use_lut; s++)
+    {
+        free(luts[s].weights);
+    }
+
+    free(luts);
+}
+
+/**
+ * This function computes the weights of the pixels of a band of rows
+ * like nlm_filter_integral_band, but only for the displacements (du, dv)
+ * after (0, 0). The weight between a pixel and its candidate is added
+ * to the accumulators of both, the candidates can be up to
+ * mid_sim_window rows after the band, so the band has its own
+ * accumulators that are merged once every thread is done.
+ *
+ * Params:
+ *      void* arg - band to filter (nlm_band_t*).
+ *
+ * Returns:
+ *      void* - NULL.
+ */
+void* nlm_filter_symmetric_band(void* arg)
+{
+    nlm_band_t* band = (nlm_band_t*) arg;
+    uint8_t* img = band->img;
+    int width = band->width;
+    int height = band->height;
+    int window_size = band->window_size;
+    int rows = band->row_end - band->row_begin;
+
+    if (rows <= 0)
+    {
+        return NULL;
+    }
+
+    // Get the middle of the windows
+    int mid_window = (int) (window_size - 1)/2;
+    int mid_sim_window = (int) (band->sim_window_size - 1)/2;
+
+    // Last row and column whose window is inside of the image
+    int last_row = height - window_size + mid_window;
+    int last_col = width - window_size + mid_window;
+
+    // The windows of the band cover rows + window_size - 1 rows
+    int first_row = band->row_begin - mid_window;
+    int integral_rows = rows + window_size - 1;
+    int stride = width + 1;
+
+    // The candidates reach mid_sim_window rows after the band
+    band->accumulator_begin = band->row_begin;
+    band->accumulator_rows = MIN(band->row_end + mid_sim_window, last_row + 1) - band->row_begin;
+
+    // Get memory for the integral image and the accumulators of the
+    // band
+    uint64_t* integral = (uint64_t*) calloc((integral_rows + 1)*stride, sizeof(uint64_t));
+    band->sums = (double*) calloc(band->accumulator_rows*width, sizeof(double));
+    band->normalization_factors = (double*) calloc(band->accumulator_rows*width, sizeof(double));
+
+    if (integral == NULL || band->sums == NULL || band->normalization_factors == NULL)
+    {
+        printf("Unable to allocate memory for the integral image.\n");
+        exit(1);
+    }
+
+    for (int du = 0; du < mid_sim_window + 1; du++)
+    {
+        // The displacements before (0, 0) are the opposite of the ones
+        // after it
+        for (int dv = du == 0 ? 0 : -mid_sim_window; dv < mid_sim_window + 1; dv++)
+        {
+            get_ssd_integral(img, integral, width, height, first_row, integral_rows, du, dv);
+
+            // Pixels whose candidate (i + du, j + dv) has its window
+            // inside of the image
+            int imin = MAX(band->row_begin, mid_window - du);
+            int imax = MIN(band->row_end - 1, last_row - du);
+            int jmin = MAX(mid_window, mid_window - dv);
+            int jmax = MIN(last_col, last_col - dv);
+
+            for (int i = imin; i < imax + 1; i++)
+            {
+                uint64_t* top = integral + (i - mid_window - first_row)*stride - mid_window;
+                uint64_t* bottom = top + window_size*stride;
+                uint8_t* pixels = img + i*width;
+                uint8_t* candidates = img + (i + du)*width + dv;
+                double* sums = band->sums + (i - band->row_begin)*width;
+                double* normalization_factors = band->normalization_factors + (i - band->row_begin)*width;
+                int offset = du*width + dv;
+
+                for (int j = jmin; j < jmax + 1; j++)
+                {
+                    // Sum of squares of the difference between the
+                    // windows
+                    uint64_t ssd = bottom[j + window_size] - bottom[j] - top[j + window_size] + top[j];
+
+                    // Similarity between pixels
+                    double similarity = get_similarity(band->lut, sqrt((double) ssd), band->variance);
+
+                    normalization_factors[j] += similarity;
+                    sums[j] += similarity*candidates[j];
+
+                    // The pixel is also a candidate of its candidate
+                    if (offset != 0)
+                    {
+                        normalization_factors[j + offset] += similarity;
+                        sums[j + offset] += similarity*pixels[j];
+                    }
+                }
+            }
+        }
+    }
+
+    // Free memory
+    free(integral);
+
+    return NULL;
+}
+
+/**
+ * This function performs a non-local means filtering on an image like
+ * nlm_filter_integral, but the distance between two windows is
+ * computed once for both of them. Only the displacements (du, dv) after
+ * (0, 0) are visited, the weight between a pixel and its candidate is
+ * added to the accumulators of both, which halves the integral images
+ * and the weights computed. The candidates of every pixel are the same
+ * as in nlm_filter, only the order of the sums changes.
+ *
+ * Params:
+ *      uint8_t* img - image to filter.
+ *      uint8_t* filtered - pointer to the filtered image.
+ *      int width - number of cols.
+ *      int height - number of rows.
+ *      int row_begin - first row to filter.
+ *      int row_end - row after the last row to filter.
+ *      int window_size - size of the window.
+ *      int sim_window_size - size of the similarity window.
+ *      double stdev - standard deviation of the gaussian
+ *                     distribution.
+ *      int use_lut - take the weights from a table instead of exp.
+ *      int threads - number of threads, each one filters a band of
+ *                    rows.
+ */
+void nlm_filter_symmetric(uint8_t* img, uint8_t* filtered, int width,
+                          int height, int row_begin, int row_end,
+                          int window_size, int sim_window_size, double stdev,
+                          int use_lut, int threads)
+{
+    // Get the middle of the window
+    int mid_window = (int) (window_size - 1)/2;
+    int mid_sim_window = (int) (sim_window_size - 1)/2;
+
+    // Rows to filter whose window is inside of the image
+    int first = MAX(row_begin, mid_window);
+    int rows = MIN(row_end, height - window_size + mid_window + 1) - first;
+
+    // Get memory for the bands and the accumulators of every pixel
+    nlm_band_t* bands = (nlm_band_t*) calloc(threads, sizeof(nlm_band_t));
+    double* sums = (double*) calloc(width*height, sizeof(double));
+    double* normalization_factors = (double*) calloc(width*height, sizeof(double));
+    weight_lut_t lut;
+
+    if (bands == NULL || sums == NULL || normalization_factors == NULL)
+    {
+        printf("Unable to allocate memory for the accumulators.\n");
+        exit(1);
+    }
+
+    if (use_lut)
+    {
+        build_weight_lut(&lut, window_size, stdev);
+    }
+
+    bands[0] = (nlm_band_t) {.img = img, .filtered = filtered, .width = width,
+                             .height = height, .window_size = window_size,
+                             .sim_window_size = sim_window_size,
+                             .variance = pow(stdev, 2.0),
+                             .lut = use_lut ? &lut : NULL};
+
+    // The pixels are also candidates of the rows up to mid_sim_window
+    // rows before them
+    run_bands(nlm_filter_symmetric_band, bands, first - mid_sim_window, row_end, threads);
+
+    merge_band_accumulators(bands, threads, sums, normalization_factors, width);
+
+    // Normalize the resulting pixels
+    if (rows > 0)
+    {
+        normalize_accumulators(sums + first*width, normalization_factors + first*width, filtered + first*width, width, rows, window_size);
+    }
+
+    // Free memory
+    free(bands);
+    free(sums);
+    free(normalization_factors);
+
+    if (use_lut)
+    {
+        free(lut.weights);
+    }
+}
+
+/**
+ * This function performs a blockwise non-local means filtering on a
+ * band of rows of an image. Only the pixels of the band on a grid of
+ * step x step pixels search for similar windows, and the whole
+ * candidate window, weighted, is added to every pixel it covers. The
+ * windows of the band reach mid_window rows around it, so the band has
+ * its own accumulators that are merged once every thread is done.
+ *
+ * Params:
+ *      void* arg - band to filter (nlm_band_t*).
+ *
+ * Returns:
+ *      void* - NULL.
+ */
+void* nlm_filter_blockwise_band(void* arg)
+{
+    nlm_band_t* band = (nlm_band_t*) arg;
+    uint8_t* img = band->img;
+    int width = band->width;
+    int height = band->height;
+    int window_size = band->window_size;
+    int step = band->step;
+    int rows = band->row_end - band->row_begin;
+
+    if (rows <= 0)
+    {
+        return NULL;
+    }
+
+    // Get the middle of the windows
+    int mid_window = (int) (window_size - 1)/2;
+    int mid_sim_window = (int) (band->sim_window_size - 1)/2;
+
+    // Last row and column whose window is inside of the image
+    int last_row = height - window_size + mid_window;
+    int last_col = width - window_size + mid_window;
+
+    // The windows of the band cover rows + window_size - 1 rows
+    band->accumulator_begin = band->row_begin - mid_window;
+    band->accumulator_rows = rows + window_size - 1;
+
+    // Get memory for the accumulators of the band
+    band->sums = (double*) calloc(band->accumulator_rows*width, sizeof(double));
+    band->normalization_factors = (double*) calloc(band->accumulator_rows*width, sizeof(double));
+
+    if (band->sums == NULL || band->normalization_factors == NULL)
+    {
+        printf("Unable to allocate memory for the accumulators.\n");
+        exit(1);
+    }
+
+    // First row of the grid in the band
+    int first = mid_window + (band->row_begin - mid_window + step - 1)/step*step;
+
+    // The grid is mid_window, mid_window + step, ... and the last row
+    // and column, so the windows of the grid cover every pixel
+    for (int i = MIN(first, last_row); i < band->row_end; i = i == last_row ? last_row + 1 : MIN(i + step, last_row))
+    {
+        if (i < band->row_begin)
+        {
+            continue;
+        }
+
+        for (int j = mid_window; j < last_col + 1; j = j == last_col ? last_col + 1 : MIN(j + step, last_col))
+        {
+            // Top left pixel of the window
+            uint8_t* window = img + (i - mid_window)*width + j - mid_window;
+
+            // Top left accumulators of the window
+            double* sums = band->sums + (i - mid_window - band->accumulator_begin)*width + j - mid_window;
+            double* normalization_factors = band->normalization_factors + (i - mid_window - band->accumulator_begin)*width + j - mid_window;
+
+            // Values for the similarity window
+            int umin = MAX(i - mid_sim_window, mid_window);
+            int umax = MIN(i + mid_sim_window, last_row);
+            int vmin = MAX(j - mid_sim_window, mid_window);
+            int vmax = MIN(j + mid_sim_window, last_col);
+
+            // Compare window against the similarity window
+            for (int u = umin; u < umax + 1; u++)
+            {
+                for (int v = vmin; v < vmax + 1; v++)
+                {
+                    // Top left pixel of the similarity window
+                    uint8_t* sim_window = img + (u - mid_window)*width + v - mid_window;
+
+                    // Similarity between windows
+                    double norm_value = sqrt((double) kernels.patch_ssd(window, sim_window, width, window_size));
+                    double similarity = get_similarity(band->lut, norm_value, band->variance);
+
+                    // Add the weighted candidate window to the pixels
+                    // of the window
+                    for (int m = 0; m < window_size; m++)
+                    {
+                        for (int n = 0; n < window_size; n++)
+                        {
+                            normalization_factors[m*width + n] += similarity;
+                            sums[m*width + n] += similarity*sim_window[m*width + n];
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * This function performs a blockwise non-local means filtering on an
+ * image. The windows centered on a grid of step x step pixels are
+ * compared against the windows of their similarity window and every
+ * pixel is the weighted mean of the candidate windows that cover it,
+ * which divides the number of searches by about step^2.
+ *
+ * Params:
+ *      uint8_t* img - image to filter.
+ *      uint8_t* filtered - pointer to the filtered image.
+ *      int width - number of cols.
+ *      int height - number of rows.
+ *      int row_begin - first row to filter.
+ *      int row_end - row after the last row to filter.
+ *      int window_size - size of the window.
+ *      int sim_window_size - size of the similarity window.
+ *      double stdev - standard deviation of the gaussian
+ *                     distribution.
+ *      int step - distance between the centers of the grid, at most
+ *                 window_size so every pixel is covered.
+ *      int use_lut - take the weights from a table instead of exp.
+ *      int threads - number of threads, each one filters a band of
+ *                    rows.
+ */
+void nlm_filter_blockwise(uint8_t* img, uint8_t* filtered, int width,
+                          int height, int row_begin, int row_end,
+                          int window_size, int sim_window_size, double stdev,
+                          int step, int use_lut, int threads)
+{
+    // Get the middle of the window
+    int mid_window = (int) (window_size - 1)/2;
+
+    // Rows to filter whose window is inside of the image
+    int first = MAX(row_begin, mid_window);
+    int rows = MIN(row_end, height - window_size + mid_window + 1) - first;
+
+    // Get memory for the bands and the accumulators of every pixel
+    nlm_band_t* bands = (nlm_band_t*) calloc(threads, sizeof(nlm_band_t));
+    double* sums = (double*) calloc(width*height, sizeof(double));
+    double* normalization_factors = (double*) calloc(width*height, sizeof(double));
+    weight_lut_t lut;
+
+    if (bands == NULL || sums == NULL || normalization_factors == NULL)
+    {
+        printf("Unable to allocate memory for the accumulators.\n");
+        exit(1);
+    }
+
+    if (use_lut)
+    {
+        build_weight_lut(&lut, window_size, stdev);
+    }
+
+    bands[0] = (nlm_band_t) {.img = img, .filtered = filtered, .width = width,
+                             .height = height, .window_size = window_size,
+                             .sim_window_size = sim_window_size,
+                             .variance = pow(stdev, 2.0),
+                             .lut = use_lut ? &lut : NULL,
+                             .step = MIN(MAX(step, 1), window_size)};
+
+    // The pixels are covered by the windows of the grid up to
+    // window_size - 1 - mid_window rows before and mid_window rows
+    // after them
+    run_bands(nlm_filter_blockwise_band, bands, first - (window_size - 1 - mid_window), row_end + mid_window, threads);
+    merge_band_accumulators(bands, threads, sums, normalization_factors, width);
+
+    // Normalize the resulting pixels
+    if (rows > 0)
+    {
+        normalize_accumulators(sums + first*width, normalization_factors + first*width, filtered + first*width, width, rows, window_size);
+    }
+
+    // Free memory
+    free(bands);
+    free(sums);
+    free(normalization_factors);
+
+    if (use_lut)
+    {
+        free(lut.weights);
+    }
+}
+
+// Largest number of windows sampled to learn the PCA basis
+#define PCA_MAX_SAMPLES 16384
+
+/**
+ * This function computes the eigenvalues and eigenvectors of a
+ * symmetric matrix with the cyclic Jacobi method. Every rotation
+ * zeroes an element out of the diagonal, the sweeps stop when the
+ * elements out of the diagonal are negligible.
+ *
+ * Params:
+ *      double* matrix - symmetric n x n matrix, it is overwritten.
+ *      double* eigenvectors - pointer to store the eigenvectors, one
+ *                             per column of a n x n matrix.
+ *      double* eigenvalues - pointer to store the n eigenvalues.
+ *      int n - size of the matrix.
+ */
+void jacobi_eigen(double* matrix, double* eigenvectors, double* eigenvalues,
+                  int n)
+{
+    double norm = 0.0;
+
+    for (int p = 0; p < n; p++)
+    {
+        for (int q = 0; q < n; q++)
+        {
+            eigenvectors[p*n + q] = p == q ? 1.0 : 0.0;
+            norm += matrix[p*n + q]*matrix[p*n + q];
+        }
+    }
+
+    for (int sweep = 0; sweep < 50; sweep++)
+    {
+        double off_diagonal = 0.0;
+
+        for (int p = 0; p < n; p++)
+        {
+            for (int q = p + 1; q < n; q++)
+            {
+                off_diagonal += matrix[p*n + q]*matrix[p*n + q];
+            }
+        }
+
+        if (off_diagonal <= 1e-22*norm)
+        {
+            break;
+        }
+
+        for (int p = 0; p < n; p++)
+        {
+            for (int q = p + 1; q < n; q++)
+            {
+                double apq = matrix[p*n + q];
+
+                if (apq == 0.0)
+                {
+                    continue;
+                }
+
+                // Rotation that zeroes the element (p, q)
+                double theta = (matrix[q*n + q] - matrix[p*n + p])/(2.0*apq);
+                double t = (theta >= 0 ? 1.0 : -1.0)/(fabs(theta) + sqrt(theta*theta + 1.0));
+                double c = 1.0/sqrt(t*t + 1.0);
+                double s = t*c;
+
+                // Columns p and q
+                for (int k = 0; k < n; k++)
+                {
+                    double akp = matrix[k*n + p];
+                    double akq = matrix[k*n + q];
+
+                    matrix[k*n + p] = c*akp - s*akq;
+                    matrix[k*n + q] = s*akp + c*akq;
+                }
+
+                // Rows p and q
+                for (int k = 0; k < n; k++)
+                {
+                    double apk = matrix[p*n + k];
+                    double aqk = matrix[q*n + k];
+
+                    matrix[p*n + k] = c*apk - s*aqk;
+                    matrix[q*n + k] = s*apk + c*aqk;
+                }
+
+                // Accumulate the rotation in the eigenvectors
+                for (int k = 0; k < n; k++)
+                {
+                    double vkp = eigenvectors[k*n + p];
+                    double vkq = eigenvectors[k*n + q];
+
+                    eigenvectors[k*n + p] = c*vkp - s*vkq;
+                    eigenvectors[k*n + q] = s*vkp + c*vkq;
+                }
+            }
+        }
+    }
+
+    for (int p = 0; p < n; p++)
+    {
+        eigenvalues[p] = matrix[p*n + p];
+    }
+}
+
+/**
+ * This function learns a PCA basis of the windows of an image and
+ * projects the window around every pixel on it. The basis is made of
+ * the dims eigenvectors of the covariance of a sample of windows with
+ * the largest eigenvalues. The differences between descriptors keep
+ * the scale of the differences between windows.
+ *
+ * Params:
+ *      uint8_t* img - image.
+ *      float* descriptors - pointer to store dims values per pixel,
+ *                           only the pixels whose window is inside of
+ *                           the image are set.
+ *      int width - number of cols.
+ *      int height - number of rows.
+ *      int window_size - size of the window.
+ *      int dims - number of dimensions of the descriptors.
+ */
+void get_pca_descriptors(uint8_t* img, float* descriptors, int width,
+                         int height, int window_size, int dims)
+{
+    // Get the middle of the window
+    int mid_window = (int) (window_size - 1)/2;
+
+    // Last row and column whose window is inside of the image
+    int last_row = height - window_size + mid_window;
+    int last_col = width - window_size + mid_window;
+
+    int n = window_size*window_size;
+
+    // Get memory for the mean window, the covariance and the basis
+    double* mean = (double*) calloc(n, sizeof(double));
+    double* covariance = (double*) calloc(n*n, sizeof(double));
+    double* eigenvectors = (double*) calloc(n*n, sizeof(double));
+    double* eigenvalues = (double*) calloc(n, sizeof(double));
+    double* centered = (double*) calloc(n, sizeof(double));
+    float* basis = (float*) calloc(dims*n, sizeof(float));
+
+    if (mean == NULL || covariance == NULL || eigenvectors == NULL ||
+        eigenvalues == NULL || centered == NULL || basis == NULL)
+    {
+        printf("Unable to allocate memory for the PCA basis.\n");
+        exit(1);
+    }
+
+    // Sample the windows on a grid with at most PCA_MAX_SAMPLES points
+    double pixels = (double) (last_row - mid_window + 1)*(last_col - mid_window + 1);
+    int stride = MAX((int) ceil(sqrt(pixels/PCA_MAX_SAMPLES)), 1);
+    long samples = 0;
+
+    for (int i = mid_window; i < last_row + 1; i += stride)
+    {
+        for (int j = mid_window; j < last_col + 1; j += stride)
+        {
+            uint8_t* window = img + (i - mid_window)*width + j - mid_window;
+
+            for (int m = 0; m < window_size; m++)
+            {
+                for (int k = 0; k < window_size; k++)
+                {
+                    mean[m*window_size + k] += window[m*width + k];
+                }
+            }
+
+            samples++;
+        }
+    }
+
+    for (int p = 0; p < n; p++)
+    {
+        mean[p] /= samples;
+    }
+
+    for (int i = mid_window; i < last_row + 1; i += stride)
+    {
+        for (int j = mid_window; j < last_col + 1; j += stride)
+        {
+            uint8_t* window = img + (i - mid_window)*width + j - mid_window;
+
+            for (int m = 0; m < window_size; m++)
+            {
+                for (int k = 0; k < window_size; k++)
+                {
+                    centered[m*window_size + k] = window[m*width + k] - mean[m*window_size + k];
+                }
+            }
+
+            // Upper triangle of the covariance
+            for (int p = 0; p < n; p++)
+            {
+                for (int q = p; q < n; q++)
+                {
+                    covariance[p*n + q] += centered[p]*centered[q];
+                }
+            }
+        }
+    }
+
+    for (int p = 0; p < n; p++)
+    {
+        for (int q = p; q < n; q++)
+        {
+            covariance[p*n + q] /= samples;
+            covariance[q*n + p] = covariance[p*n + q];
+        }
+    }
+
+    jacobi_eigen(covariance, eigenvectors, eigenvalues, n);
+
+    // Keep the eigenvectors with the largest eigenvalues
+    for (int d = 0; d < dims; d++)
+    {
+        int largest = 0;
+
+        for (int p = 1; p < n; p++)
+        {
+            if (eigenvalues[p] > eigenvalues[largest])
+            {
+                largest = p;
+            }
+        }
+
+        for (int p = 0; p < n; p++)
+        {
+            basis[d*n + p] = (float) eigenvectors[p*n + largest];
+        }
+
+        eigenvalues[largest] = -INFINITY;
+    }
+
+    // Project the window of every pixel
+    for (int i = mid_window; i < last_row + 1; i++)
+    {
+        for (int j = mid_window; j < last_col + 1; j++)
+        {
+            uint8_t* window = img + (i - mid_window)*width + j - mid_window;
+            float* descriptor = descriptors + ((long) i*width + j)*dims;
+
+            for (int m = 0; m < window_size; m++)
+            {
+                for (int k = 0; k < window_size; k++)
+                {
+                    centered[m*window_size + k] = window[m*width + k] - mean[m*window_size + k];
+                }
+            }
+
+            for (int d = 0; d < dims; d++)
+            {
+                float value = 0.0f;
+
+                for (int p = 0; p < n; p++)
+                {
+                    value += basis[d*n + p]*(float) centered[p];
+                }
+
+                descriptor[d] = value;
+            }
+        }
+    }
+
+    // Free memory
+    free(mean);
+    free(covariance);
+    free(eigenvectors);
+    free(eigenvalues);
+    free(centered);
+    free(basis);
+}
+
+/**
+ * This function performs a non-local means filtering on a band of rows
+ * of an image, comparing the PCA descriptors of the windows instead of
+ * the windows.
+ *
+ * Params:
+ *      void* arg - band to filter (nlm_band_t*).
+ *
+ * Returns:
+ *      void* - NULL.
+ */
+void* nlm_filter_pca_band(void* arg)
+{
+    nlm_band_t* band = (nlm_band_t*) arg;
+    uint8_t* img = band->img;
+    int width = band->width;
+    int height = band->height;
+    int dims = band->dims;
+
+    // Get the middle of the windows
+    int mid_window = (int) (band->window_size - 1)/2;
+    int mid_sim_window = (int) (band->sim_window_size - 1)/2;
+
+    // Last row and column whose window is inside of the image
+    int last_row = height - band->window_size + mid_window;
+    int last_col = width - band->window_size + mid_window;
+
+    for (int i = band->row_begin; i < band->row_end; i++)
+    {
+        for (int j = mid_window; j < last_col + 1; j++)
+        {
+            float* descriptor = band->descriptors + ((long) i*width + j)*dims;
+            double sum = 0.0;
+            double normalization_factor = 0.0;
+
+            // Values for the similarity window
+            int umin = MAX(i - mid_sim_window, mid_window);
+            int umax = MIN(i + mid_sim_window, last_row);
+            int vmin = MAX(j - mid_sim_window, mid_window);
+            int vmax = MIN(j + mid_sim_window, last_col);
+
+            for (int u = umin; u < umax + 1; u++)
+            {
+                for (int v = vmin; v < vmax + 1; v++)
+                {
+                    float* candidate = band->descriptors + ((long) u*width + v)*dims;
+                    float distance = 0.0f;
+
+                    // Distance between the descriptors
+                    for (int d = 0; d < dims; d++)
+                    {
+                        float difference = descriptor[d] - candidate[d];
+
+                        distance += difference*difference;
+                    }
+
+                    // Similarity between pixels
+                    double similarity = get_similarity(band->lut, sqrt((double) distance), band->variance);
+
+                    normalization_factor += similarity;
+                    sum += similarity*img[u*width + v];
+                }
+            }
+
+            // Normalize the resulting pixel
+            double result = sum/normalization_factor;
+            uint8_t value = 0;
+
+            // Keep the pixel value between 0 and 255, avoiding
+            // unexpected values
+            if (result > 255)
+            {
+                value = 255;
+            } else if (result > 0)
+            {
+                value = (uint8_t) round(result);
+            }
+
+            band->filtered[i*width + j] = value;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * This function performs a non-local means filtering on an image
+ * comparing PCA descriptors of dims dimensions instead of windows of
+ * window_size x window_size pixels. The basis is learnt from the
+ * image, so the cost of a comparison does not depend on the window
+ * size and the noise out of the main components is ignored.
+ *
+ * Params:
+ *      uint8_t* img - image to filter.
+ *      uint8_t* filtered - pointer to the filtered image.
+ *      int width - number of cols.
+ *      int height - number of rows.
+ *      int row_begin - first row to filter.
+ *      int row_end - row after the last row to filter.
+ *      int window_size - size of the window.
+ *      int sim_window_size - size of the similarity window.
+ *      double stdev - standard deviation of the gaussian
+ *                     distribution.
+ *      int dims - number of dimensions of the descriptors, at most
+ *                 window_size^2.
+ *      int use_lut - take the weights from a table instead of exp.
+ *      int threads - number of threads, each one filters a band of
+ *                    rows.
+ */
+void nlm_filter_pca(uint8_t* img, uint8_t* filtered, int width, int height,
+                    int row_begin, int row_end, int window_size,
+                    int sim_window_size, double stdev, int dims, int use_lut,
+                    int threads)
+{
+    // Get memory for the bands and the descriptors
+    dims = MIN(MAX(dims, 1), window_size*window_size);
+    nlm_band_t* bands = (nlm_band_t*) calloc(threads, sizeof(nlm_band_t));
+    float* descriptors = (float*) calloc((long) width*height*dims, sizeof(float));
+    weight_lut_t lut;
+
+    if (bands == NULL || descriptors == NULL)
+    {
+        printf("Unable to allocate memory for the descriptors.\n");
+        exit(1);
+    }
+
+    if (height < window_size || width < window_size)
+    {
+        free(bands);
+        free(descriptors);
+        return;
+    }
+
+    get_pca_descriptors(img, descriptors, width, height, window_size, dims);
+
+    if (use_lut)
+    {
+        build_weight_lut(&lut, window_size, stdev);
+    }
+
+    bands[0] = (nlm_band_t) {.img = img, .filtered = filtered, .width = width,
+                             .height = height, .window_size = window_size,
+                             .sim_window_size = sim_window_size,
+                             .variance = pow(stdev, 2.0),
+                             .lut = use_lut ? &lut : NULL,
+                             .descriptors = descriptors, .dims = dims};
+
+    run_bands(nlm_filter_pca_band, bands, row_begin, row_end, threads);
+
+    // Free memory
+    free(bands);
+    free(descriptors);
+
+    if (use_lut)
+    {
+        free(lut.weights);
+    }
+}
+
+// Passes of propagation and random search of nlm_filter_patchmatch
+#define PATCHMATCH_ITERATIONS 4
+
+/**
+ * This function returns the next number of a xorshift generator, so
+ * every band draws the same sequence whatever the scheduling.
+ *
+ * Params:
+ *      uint32_t* state - state of the generator, not 0.
+ *
+ * Returns:
+ *      uint32_t - random number.
+ */
+INLINE_KERNEL uint32_t next_random(uint32_t* state)
+{
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+
+    return *state = x;
+}
+
+/**
+ * This function tries a candidate offset for a pixel and keeps it if it
+ * is closer than the farthest of the best offsets found so far. The
+ * best offsets are sorted by distance and the empty ones have distance
+ * UINT32_MAX.
+ *
+ * Params:
+ *      nlm_band_t* band - band with the arguments of the filter.
+ *      int16_t* offsets - best offsets of the pixel, (du, dv) pairs.
+ *      uint32_t* distances - distances of the best offsets.
+ *      int i - row of the pixel.
+ *      int j - column of the pixel.
+ *      int du - row offset of the candidate.
+ *      int dv - column offset of the candidate.
+ */
+INLINE_KERNEL void try_offset(nlm_band_t* band, int16_t* offsets,
+                              uint32_t* distances, int i, int j, int du,
+                              int dv)
+{
+    int neighbors = band->neighbors;
+    int width = band->width;
+    int mid_window = (int) (band->window_size - 1)/2;
+
+    // Skip the offsets already kept
+    for (int k = 0; k < neighbors && distances[k] != UINT32_MAX; k++)
+    {
+        if (offsets[2*k] == du && offsets[2*k + 1] == dv)
+        {
+            return;
+        }
+    }
+
+    // Top left pixels of the windows
+    uint8_t* window = band->img + (i - mid_window)*width + j - mid_window;
+    uint8_t* sim_window = window + du*width + dv;
+    uint32_t distance = kernels.patch_ssd(window, sim_window, width, band->window_size);
+
+    if (distance >= distances[neighbors - 1])
+    {
+        return;
+    }
+
+    // Insert the offset keeping them sorted
+    int k = neighbors - 1;
+
+    for (; k > 0 && distances[k - 1] > distance; k--)
+    {
+        distances[k] = distances[k - 1];
+        offsets[2*k] = offsets[2*(k - 1)];
+        offsets[2*k + 1] = offsets[2*(k - 1) + 1];
+    }
+
+    distances[k] = distance;
+    offsets[2*k] = (int16_t) du;
+    offsets[2*k + 1] = (int16_t) dv;
+}
+
+/**
+ * This function performs an approximate non-local means filtering on a
+ * band of rows of an image. Every pixel keeps the neighbors offsets of
+ * the similarity window with the closest windows found by PatchMatch:
+ * they start at random, then the pixels try the offsets of the pixels
+ * next to them in the band and random offsets around their own ones at
+ * decreasing radius. Only those offsets are weighted.
+ *
+ * Params:
+ *      void* arg - band to filter (nlm_band_t*).
+ *
+ * Returns:
+ *      void* - NULL.
+ */
+void* nlm_filter_patchmatch_band(void* arg)
+{
+    nlm_band_t* band = (nlm_band_t*) arg;
+    uint8_t* img = band->img;
+    int width = band->width;
+    int height = band->height;
+    int neighbors = band->neighbors;
+    int rows = band->row_end - band->row_begin;
+
+    if (rows <= 0)
+    {
+        return NULL;
+    }
+
+    // Get the middle of the windows
+    int mid_window = (int) (band->window_size - 1)/2;
+    int mid_sim_window = (int) (band->sim_window_size - 1)/2;
+
+    // Last row and column whose window is inside of the image
+    int last_row = height - band->window_size + mid_window;
+    int last_col = width - band->window_size + mid_window;
+
+    // Get memory for the best offsets of the pixels of the band
+    int16_t* offsets = (int16_t*) calloc((long) rows*width*neighbors*2, sizeof(int16_t));
+    uint32_t* distances = (uint32_t*) calloc((long) rows*width*neighbors, sizeof(uint32_t));
+    int16_t* previous = (int16_t*) calloc(neighbors*2, sizeof(int16_t));
+
+    if (offsets == NULL || distances == NULL || previous == NULL)
+    {
+        printf("Unable to allocate memory for the offsets.\n");
+        exit(1);
+    }
+
+    uint32_t state = 2463534242u + band->row_begin;
+
+    // Start with the pixel itself and random offsets
+    for (int i = band->row_begin; i < band->row_end; i++)
+    {
+        int dumin = MAX(-mid_sim_window, mid_window - i);
+        int dumax = MIN(mid_sim_window, last_row - i);
+
+        for (int j = mid_window; j < last_col + 1; j++)
+        {
+            int16_t* pixel_offsets = offsets + ((long) (i - band->row_begin)*width + j)*neighbors*2;
+            uint32_t* pixel_distances = distances + ((long) (i - band->row_begin)*width + j)*neighbors;
+            int dvmin = MAX(-mid_sim_window, mid_window - j);
+            int dvmax = MIN(mid_sim_window, last_col - j);
+
+            for (int k = 0; k < neighbors; k++)
+            {
+                pixel_distances[k] = UINT32_MAX;
+            }
+
+            try_offset(band, pixel_offsets, pixel_distances, i, j, 0, 0);
+
+            for (int k = 1; k < neighbors; k++)
+            {
+                int du = dumin + (int) (next_random(&state) % (dumax - dumin + 1));
+                int dv = dvmin + (int) (next_random(&state) % (dvmax - dvmin + 1));
+
+                try_offset(band, pixel_offsets, pixel_distances, i, j, du, dv);
+            }
+        }
+    }
+
+    for (int iteration = 0; iteration < PATCHMATCH_ITERATIONS; iteration++)
+    {
+        // Scan forwards on even iterations and backwards on odd ones,
+        // propagating from the pixels already visited
+        int direction = iteration % 2 == 0 ? 1 : -1;
+        int ibegin = direction > 0 ? band->row_begin : band->row_end - 1;
+        int jbegin = direction > 0 ? mid_window : last_col;
+
+        for (int i = ibegin; i >= band->row_begin && i < band->row_end; i += direction)
+        {
+            int dumin = MAX(-mid_sim_window, mid_window - i);
+            int dumax = MIN(mid_sim_window, last_row - i);
+
+            for (int j = jbegin; j >= mid_window && j < last_col + 1; j += direction)
+            {
+                long pixel = (long) (i - band->row_begin)*width + j;
+                int16_t* pixel_offsets = offsets + pixel*neighbors*2;
+                uint32_t* pixel_distances = distances + pixel*neighbors;
+                int dvmin = MAX(-mid_sim_window, mid_window - j);
+                int dvmax = MIN(mid_sim_window, last_col - j);
+
+                // Offsets of the previous pixel in the row and in the
+                // column
+                for (int n = 0; n < 2; n++)
+                {
+                    int pi = n == 0 ? i : i - direction;
+                    int pj = n == 0 ? j - direction : j;
+
+                    if (pi < band->row_begin || pi >= band->row_end ||
+                        pj < mid_window || pj > last_col)
+                    {
+                        continue;
+                    }
+
+                    long neighbor = (long) (pi - band->row_begin)*width + pj;
+
+                    for (int k = 0; k < neighbors && distances[neighbor*neighbors + k] != UINT32_MAX; k++)
+                    {
+                        int du = offsets[(neighbor*neighbors + k)*2];
+                        int dv = offsets[(neighbor*neighbors + k)*2 + 1];
+
+                        if (du >= dumin && du <= dumax && dv >= dvmin && dv <= dvmax)
+                        {
+                            try_offset(band, pixel_offsets, pixel_distances, i, j, du, dv);
+                        }
+                    }
+                }
+
+                // Random offsets around the current ones
+                memcpy(previous, pixel_offsets, neighbors*2*sizeof(int16_t));
+
+                for (int k = 0; k < neighbors && pixel_distances[k] != UINT32_MAX; k++)
+                {
+                    for (int radius = mid_sim_window; radius > 0; radius /= 2)
+                    {
+                        int du = previous[2*k] + (int) (next_random(&state) % (2*radius + 1)) - radius;
+                        int dv = previous[2*k + 1] + (int) (next_random(&state) % (2*radius + 1)) - radius;
+
+                        du = MIN(MAX(du, dumin), dumax);
+                        dv = MIN(MAX(dv, dvmin), dvmax);
+
+                        try_offset(band, pixel_offsets, pixel_distances, i, j, du, dv);
+                    }
+                }
+            }
+        }
+    }
+
+    // Weight the best offsets of every pixel
+    for (int i = band->row_begin; i < band->row_end; i++)
+    {
+        for (int j = mid_window; j < last_col + 1; j++)
+        {
+            long pixel = (long) (i - band->row_begin)*width + j;
+            double sum = 0.0;
+            double normalization_factor = 0.0;
+
+            for (int k = 0; k < neighbors && distances[pixel*neighbors + k] != UINT32_MAX; k++)
+            {
+                int du = offsets[(pixel*neighbors + k)*2];
+                int dv = offsets[(pixel*neighbors + k)*2 + 1];
+
+                // Similarity between pixels
+                double similarity = get_similarity(band->lut, sqrt((double) distances[pixel*neighbors + k]), band->variance);
+
+                normalization_factor += similarity;
+                sum += similarity*img[(i + du)*width + j + dv];
+            }
+
+            // Normalize the resulting pixel
+            double result = sum/normalization_factor;
+            uint8_t value = 0;
+
+            // Keep the pixel value between 0 and 255, avoiding
+            // unexpected values
+            if (result > 255)
+            {
+                value = 255;
+            } else if (result > 0)
+            {
+                value = (uint8_t) round(result);
+            }
+
+            band->filtered[i*width + j] = value;
+        }
+    }
+
+    // Free memory
+    free(offsets);
+    free(distances);
+    free(previous);
+
+    return NULL;
+}
+
+/**
+ * This function performs an approximate non-local means filtering on
+ * an image weighting only the neighbors closest windows of the
+ * similarity window found by PatchMatch. The cost grows with neighbors
+ * and the logarithm of the similarity window instead of its area, so
+ * large similarity windows become affordable. Each thread searches its
+ * own band of rows, so the result depends on the number of threads.
+ *
+ * Params:
+ *      uint8_t* img - image to filter.
+ *      uint8_t* filtered - pointer to the filtered image.
+ *      int width - number of cols.
+ *      int height - number of rows.
+ *      int row_begin - first row to filter.
+ *      int row_end - row after the last row to filter.
+ *      int window_size - size of the window.
+ *      int sim_window_size - size of the similarity window.
+ *      double stdev - standard deviation of the gaussian
+ *                     distribution.
+ *      int neighbors - number of offsets weighted for every pixel.
+ *      int use_lut - take the weights from a table instead of exp.
+ *      int threads - number of threads, each one filters a band of
+ *                    rows.
+ */
+void nlm_filter_patchmatch(uint8_t* img, uint8_t* filtered, int width,
+                           int height, int row_begin, int row_end,
+                           int window_size, int sim_window_size, double stdev,
+                           int neighbors, int use_lut, int threads)
+{
+    nlm_band_t* bands = (nlm_band_t*) calloc(threads, sizeof(nlm_band_t));
+    weight_lut_t lut;
+
+    if (bands == NULL)
+    {
+        printf("Unable to allocate memory for the bands.\n");
+        exit(1);
+    }
+
+    if (use_lut)
+    {
+        build_weight_lut(&lut, window_size, stdev);
+    }
+
+    // Get the middle of the similarity window
+    int mid_sim_window = (int) (sim_window_size - 1)/2;
+
+    bands[0] = (nlm_band_t) {.img = img, .filtered = filtered, .width = width,
+                             .height = height, .window_size = window_size,
+                             .sim_window_size = sim_window_size,
+                             .variance = pow(stdev, 2.0),
+                             .lut = use_lut ? &lut : NULL,
+                             .neighbors = MIN(MAX(neighbors, 1), (2*mid_sim_window + 1)*(2*mid_sim_window + 1))};
+
+    run_bands(nlm_filter_patchmatch_band, bands, row_begin, row_end, threads);
+
+    // Free memory
+    free(bands);
+
+    if (use_lut)
+    {
+        free(lut.weights);
+    }
+}
+
+// Specialized kernels of an instruction set
+#define SPECIALIZED_KERNELS(isa)                                             \
+    {patch_ssd_##isa##_3, patch_ssd_##isa##_5, patch_ssd_##isa##_7,          \
+     patch_ssd_##isa##_9, patch_ssd_##isa##_11}
+
+/**
+ * This function binds the kernels to the widest instruction set
+ * supported by the CPU, or to the one requested if the CPU supports
+ * it. The CPU is probed with CPUID only once. If there are kernels
+ * specialized for the window size, they replace the generic ones.
+ *
+ * Params:
+ *      const char* isa - name of the instruction set to use (scalar,
+ *                        sse2, avx2 or avx512) or NULL to use the
+ *                        widest one.
+ *      int window_size - size of the window given in the arguments.
+ *
+ * Returns:
+ *      const char* - name of the instruction set bound.
+ */
+const char* select_kernels(const char* isa, int window_size)
+{
+    // Instruction set variants, from the narrowest to the widest
+    static const filter_kernels_t variants[] = {
+        {"scalar", rgb2gray_scalar, patch_ssd_scalar,
+         SPECIALIZED_KERNELS(scalar)},
+#ifdef HAVE_X86_SIMD
+        {"sse2", rgb2gray_sse2, patch_ssd_sse2,
+         SPECIALIZED_KERNELS(sse2)},
+        {"avx2", rgb2gray_avx2, patch_ssd_avx2,
+         SPECIALIZED_KERNELS(avx2)},
+        {"avx512", rgb2gray_avx512, patch_ssd_avx512,
+         SPECIALIZED_KERNELS(avx512)},
+#endif
+    };
+    static int best = -1;
+    int selected;
+
+    if (best < 0)
+    {
+        best = 0;
+
+#ifdef HAVE_X86_SIMD
+        __builtin_cpu_init();
+
+        if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+        {
+            best = 3;
+        } else if (__builtin_cpu_supports("avx2"))
+        {
+            best = 2;
+        } else if (__builtin_cpu_supports("sse2"))
+        {
+            best = 1;
+        }
+#endif
+    }
+
+    selected = best;
+
+    if (isa != NULL)
+    {
+        int count = sizeof(variants)/sizeof(variants[0]);
+
+        for (selected = 0; selected < count; selected++)
+        {
+            if (strcmp(variants[selected].isa, isa) == 0)
+            {
+                break;
+            }
+        }
+
+        if (selected == count)
+        {
+            printf("Unknown instruction set %s, using %s.\n", isa, variants[best].isa);
+            selected = best;
+        } else if (selected > best)
+        {
+            printf("The CPU does not support %s, using %s.\n", isa, variants[best].isa);
+            selected = best;
+        }
+    }
+
+    kernels = variants[selected];
+
+    // Specializations are generated for odd sizes from 3 to 11
+    if (window_size >= 3 && window_size <= 11 && window_size % 2 == 1)
+    {
+        int index = (window_size - 3)/2;
+
+        kernels.patch_ssd = kernels.patch_ssd_sized[index];
+    }
+
+    return kernels.isa;
+}
+
+/**
+ * Implementations of the non-local means filter.
+ */
+typedef enum
+{
+    // Window by window (nlm_filter)
+    NLM_DIRECT,
+    // Offset by offset with integral images (nlm_filter_integral)
+    NLM_INTEGRAL,
+    // Half of the offsets with integral images (nlm_filter_symmetric)
+    NLM_SYMMETRIC,
+    // Window by window in tiles that fit in L1 (nlm_filter_tiled)
+    NLM_TILED,
+    // Windows on a grid added to every pixel they cover
+    // (nlm_filter_blockwise)
+    NLM_BLOCKWISE,
+    // PCA descriptors of the windows (nlm_filter_pca)
+    NLM_PCA,
+    // Rows swept with running column sums (nlm_filter_sweep)
+    NLM_SWEEP,
+    // Closest windows found by PatchMatch (nlm_filter_patchmatch)
+    NLM_PATCHMATCH,
+    // Offset by offset in single precision (nlm_filter_float)
+    NLM_FLOAT
+} nlm_mode_t;
+
+/**
+ * Ways the MPI program distributes the work among the ranks.
+ */
+typedef enum
+{
+    // Every rank filters whole images, balancing the estimated cost
+    // of the images of every rank
+    DISTRIBUTE_LPT,
+    // Every rank filters whole images, in turns
+    DISTRIBUTE_IMAGES,
+    // Every image is split in strips of rows, one per rank
+    DISTRIBUTE_STRIPS,
+    // Rank 0 hands out the images to the other ranks on demand
+    DISTRIBUTE_DYNAMIC,
+    // Every rank claims the next image from a counter in rank 0
+    DISTRIBUTE_COUNTER
+} distribution_t;
+
+// Largest number of standard deviations given with --sigmas
+#define NLM_MAX_SIGMAS 16
+
+/**
+ * Options given to the program with --name=value arguments.
+ */
+typedef struct
+{
+    // Filter implementation
+    nlm_mode_t mode;
+    // Distance between the centers of the grid for NLM_BLOCKWISE
+    int step;
+    // Dimensions of the descriptors for NLM_PCA
+    int dims;
+    // Offsets weighted for every pixel for NLM_PATCHMATCH
+    int neighbors;
+    // Standard deviations filtered at once instead of the one given
+    double sigmas[NLM_MAX_SIGMAS];
+    int sigma_count;
+    // Skip the candidates with a different mean or variance
+    int preselect;
+    nlm_preselect_t thresholds;
+    // Take the similarity weights from a table instead of exp
+    int lut;
+    // Number of threads filtering each image
+    int threads;
+    // Compare the result against the exact filter
+    int report;
+    // Compare the cache misses of the direct filter in rows and tiles
+    int benchmark;
+    // Work given to every rank of the MPI program
+    distribution_t distribution;
+    // Instruction set of the kernels, NULL to use the widest one
+    const char* isa;
+} nlm_options_t;
+
+/**
+ * This function reads the --name=value options from the arguments and
+ * removes them, leaving only the positional arguments in argv.
+ *
+ * Params:
+ *      int argc - number of arguments.
+ *      char* argv[] - arguments.
+ *      nlm_options_t* options - pointer to store the options.
+ *
+ * Returns:
+ *      int - number of arguments left in argv or -1 if an option is
+ *            not valid.
+ */
+int parse_options(int argc, char* argv[], nlm_options_t* options)
+{
+    int positional = 1;
+
+    // Options that only apply to some modes or to --preselect
+    int step = 0;
+    int dims = 0;
+    int neighbors = 0;
+    int thresholds = 0;
+
+    // Default options
+    options->mode = NLM_INTEGRAL;
+    options->step = 2;
+    options->dims = 8;
+    options->neighbors = 16;
+    options->sigma_count = 0;
+    options->distribution = DISTRIBUTE_LPT;
+    options->preselect = 0;
+    options->thresholds.mean_threshold = 8.0;
+    options->thresholds.variance_ratio = 2.0;
+    options->lut = 0;
+    options->threads = 1;
+    options->report = 0;
+    options->benchmark = 0;
+    options->isa = NULL;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (strncmp(argv[i], "--", 2) != 0)
+        {
+            // Keep the positional argument
+            argv[positional++] = argv[i];
+        } else if (strcmp(argv[i], "--mode=direct") == 0)
+        {
+            options->mode = NLM_DIRECT;
+        } else if (strcmp(argv[i], "--mode=integral") == 0)
+        {
+            options->mode = NLM_INTEGRAL;
+        } else if (strcmp(argv[i], "--mode=symmetric") == 0)
+        {
+            options->mode = NLM_SYMMETRIC;
+        } else if (strcmp(argv[i], "--mode=tiled") == 0)
+        {
+            options->mode = NLM_TILED;
+        } else if (strcmp(argv[i], "--mode=blockwise") == 0)
+        {
+            options->mode = NLM_BLOCKWISE;
+        } else if (strncmp(argv[i], "--step=", 7) == 0)
+        {
+            options->step = atoi(argv[i] + 7);
+            step = 1;
+
+            if (options->step < 1)
+            {
+                printf("The step must be at least 1.\n");
+                return -1;
+            }
+        } else if (strncmp(argv[i], "--sigmas=", 9) == 0)
+        {
+            char* value = argv[i] + 9;
+
+            // Comma separated list of standard deviations
+            while (*value != '\0')
+            {
+                char* end;
+                double sigma = strtod(value, &end);
+
+                if (end == value || sigma <= 0 || options->sigma_count == NLM_MAX_SIGMAS)
+                {
+                    printf("The sigmas must be a list of at most %d positive numbers.\n", NLM_MAX_SIGMAS);
+                    return -1;
+                }
+
+                options->sigmas[options->sigma_count++] = sigma;
+                value = *end == ',' ? end + 1 : end;
+            }
+        } else if (strcmp(argv[i], "--mode=float") == 0)
+        {
+            options->mode = NLM_FLOAT;
+        } else if (strcmp(argv[i], "--mode=patchmatch") == 0)
+        {
+            options->mode = NLM_PATCHMATCH;
+        } else if (strncmp(argv[i], "--neighbors=", 12) == 0)
+        {
+            options->neighbors = atoi(argv[i] + 12);
+            neighbors = 1;
+
+            if (options->neighbors < 1)
+            {
+                printf("PatchMatch needs at least 1 neighbor.\n");
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--mode=sweep") == 0)
+        {
+            options->mode = NLM_SWEEP;
+        } else if (strcmp(argv[i], "--mode=pca") == 0)
+        {
+            options->mode = NLM_PCA;
+        } else if (strncmp(argv[i], "--pca-dims=", 11) == 0)
+        {
+            options->dims = atoi(argv[i] + 11);
+            dims = 1;
+
+            if (options->dims < 1)
+            {
+                printf("The PCA descriptors need at least 1 dimension.\n");
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--preselect") == 0)
+        {
+            options->preselect = 1;
+        } else if (strncmp(argv[i], "--mean-threshold=", 17) == 0)
+        {
+            options->thresholds.mean_threshold = atof(argv[i] + 17);
+            thresholds = 1;
+        } else if (strncmp(argv[i], "--variance-ratio=", 17) == 0)
+        {
+            options->thresholds.variance_ratio = atof(argv[i] + 17);
+            thresholds = 1;
+
+            if (options->thresholds.variance_ratio < 1.0)
+            {
+                printf("The variance ratio must be at least 1.\n");
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--lut") == 0)
+        {
+            options->lut = 1;
+        } else if (strncmp(argv[i], "--threads=", 10) == 0)
+        {
+            options->threads = atoi(argv[i] + 10);
+
+            if (options->threads < 1)
+            {
+                printf("The number of threads must be at least 1.\n");
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--report") == 0)
+        {
+            options->report = 1;
+        } else if (strcmp(argv[i], "--benchmark") == 0)
+        {
+            options->benchmark = 1;
+        } else if (strcmp(argv[i], "--distribute=lpt") == 0)
+        {
+            options->distribution = DISTRIBUTE_LPT;
+        } else if (strcmp(argv[i], "--distribute=images") == 0)
+        {
+            options->distribution = DISTRIBUTE_IMAGES;
+        } else if (strcmp(argv[i], "--distribute=strips") == 0)
+        {
+            options->distribution = DISTRIBUTE_STRIPS;
+        } else if (strcmp(argv[i], "--distribute=dynamic") == 0)
+        {
+            options->distribution = DISTRIBUTE_DYNAMIC;
+        } else if (strcmp(argv[i], "--distribute=counter") == 0)
+        {
+            options->distribution = DISTRIBUTE_COUNTER;
+        } else if (strncmp(argv[i], "--isa=", 6) == 0)
+        {
+            options->isa = argv[i] + 6;
+        } else
+        {
+            printf("Unknown option %s.\n", argv[i]);
+            return -1;
+        }
+    }
+
+    // Refuse the options the selected mode would ignore. The benchmark
+    // runs the direct and tiled filters whatever the mode, and --sigmas
+    // ignores the mode
+    int sweep = options->sigma_count > 0;
+
+    if (options->preselect && (sweep || (options->mode != NLM_DIRECT && options->mode != NLM_TILED && !options->benchmark)))
+    {
+        printf("--preselect only applies to --mode=direct|tiled, without --sigmas.\n");
+        return -1;
+    }
+
+    if (thresholds && !options->preselect)
+    {
+        printf("--mean-threshold and --variance-ratio only apply with --preselect.\n");
+        return -1;
+    }
+
+    if (step && (sweep || options->mode != NLM_BLOCKWISE))
+    {
+        printf("--step only applies to --mode=blockwise, without --sigmas.\n");
+        return -1;
+    }
+
+    if (dims && (sweep || options->mode != NLM_PCA))
+    {
+        printf("--pca-dims only applies to --mode=pca, without --sigmas.\n");
+        return -1;
+    }
+
+    if (neighbors && (sweep || options->mode != NLM_PATCHMATCH))
+    {
+        printf("--neighbors only applies to --mode=patchmatch, without --sigmas.\n");
+        return -1;
+    }
+
+    return positional;
+}
+
+/**
+ * This function filters an image with the selected non-local means
+ * filter implementation.
+ *
+ * Params:
+ *      uint8_t* img - image to filter.
+ *      uint8_t* filtered - pointer to the filtered image.
+ *      int width - number of cols.
+ *      int height - number of rows.
+ *      int row_begin - first row to filter.
+ *      int row_end - row after the last row to filter.
+ *      int window_size - size of the window.
+ *      int sim_window_size - size of the similarity window.
+ *      double stdev - standard deviation of the gaussian
+ *                     distribution.
+ *      nlm_options_t* options - filter implementation and its options.
+ */
+void apply_nlm_filter(uint8_t* img, uint8_t* filtered, int width, int height,
+                      int row_begin, int row_end, int window_size,
+                      int sim_window_size, double stdev,
+                      nlm_options_t* options)
+{
+    switch (options->mode)
+    {
+        case NLM_DIRECT:
+            nlm_filter(img, filtered, width, height, row_begin, row_end, window_size, sim_window_size, stdev, options->lut, options->preselect ? &options->thresholds : NULL, options->threads);
+            break;
+        case NLM_SYMMETRIC:
+            nlm_filter_symmetric(img, filtered, width, height, row_begin, row_end, window_size, sim_window_size, stdev, options->lut, options->threads);
+            break;
+        case NLM_TILED:
+            nlm_filter_tiled(img, filtered, width, height, row_begin, row_end, window_size, sim_window_size, stdev, options->lut, options->preselect ? &options->thresholds : NULL, options->threads);
+            break;
+        case NLM_FLOAT:
+            nlm_filter_float(img, filtered, width, height, row_begin, row_end, window_size, sim_window_size, stdev, options->lut, options->threads);
+            break;
+        case NLM_PATCHMATCH:
+            nlm_filter_patchmatch(img, filtered, width, height, row_begin, row_end, window_size, sim_window_size, stdev, options->neighbors, options->lut, options->threads);
+            break;
+        case NLM_SWEEP:
+            nlm_filter_sweep(img, filtered, width, height, row_begin, row_end, window_size, sim_window_size, stdev, options->lut, options->threads);
+            break;
+        case NLM_PCA:
+            nlm_filter_pca(img, filtered, width, height, row_begin, row_end, window_size, sim_window_size, stdev, options->dims, options->lut, options->threads);
+            break;
+        case NLM_BLOCKWISE:
+            nlm_filter_blockwise(img, filtered, width, height, row_begin, row_end, window_size, sim_window_size, stdev, options->step, options->lut, options->threads);
+            break;
+        default:
+            nlm_filter_integral(img, filtered, width, height, row_begin, row_end, window_size, sim_window_size, stdev, options->lut, options->threads);
+            break;
+    }
+}
+
+/**
+ * This function prints how far a filtered image drifts from a
+ * reference. Only the pixels where the reference is defined (where
+ * the window is inside of the image) are compared.
+ *
+ * Params:
+ *      const char* name - name of the image.
+ *      uint8_t* reference - reference image.
+ *      uint8_t* filtered - image to compare.
+ *      int width - number of cols.
+ *      int height - number of rows.
+ *      int window_size - size of the window.
+ */
+void print_accuracy_report(const char* name, uint8_t* reference,
+                           uint8_t* filtered, int width, int height,
+                           int window_size)
+{
+    // Get the middle of the window
+    int mid_window = (int) (window_size - 1)/2;
+
+    // Last row and column whose window is inside of the image
+    int last_row = height - window_size + mid_window;
+    int last_col = width - window_size + mid_window;
+
+    int max_error = 0;
+    double abs_error = 0.0;
+    double squared_error = 0.0;
+    long pixels = 0;
+
+    for (int i = mid_window; i < last_row + 1; i++)
+    {
+        for (int j = mid_window; j < last_col + 1; j++)
+        {
+            int error = abs(reference[i*width + j] - filtered[i*width + j]);
+
+            max_error = MAX(max_error, error);
+            abs_error += error;
+            squared_error += error*error;
+            pixels++;
+        }
+    }
+
+    if (pixels == 0)
+    {
+        printf("%s: the image is smaller than the window.\n", name);
+        return;
+    }
+
+    double mse = squared_error/pixels;
+
+    if (mse == 0)
+    {
+        printf("%s: max error 0, mean error 0.0000, PSNR inf dB\n", name);
+    } else
+    {
+        printf("%s: max error %d, mean error %.4f, PSNR %.2f dB\n", name,
+               max_error, abs_error/pixels, 10*log10(255.0*255.0/mse));
+    }
+}
+
+#ifdef __linux__
+/**
+ * This function opens a counter of the cache misses of this process
+ * and the threads it creates.
+ *
+ * Returns:
+ *      int - file descriptor of the counter or -1 if the kernel does
+ *            not allow it.
+ */
+int open_cache_miss_counter(void)
+{
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.inherit = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    return (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#else
+int open_cache_miss_counter(void)
+{
+    return -1;
+}
+#endif
+
+/**
+ * This function filters an image window by window in rows and in
+ * tiles and prints the time and the cache misses of both. The cache
+ * misses are only printed if the kernel allows to count them.
+ *
+ * Params:
+ *      const char* name - name of the image.
+ *      uint8_t* img - image to filter.
+ *      int width - number of cols.
+ *      int height - number of rows.
+ *      int window_size - size of the window.
+ *      int sim_window_size - size of the similarity window.
+ *      double stdev - standard deviation of the gaussian
+ *                     distribution.
+ *      nlm_options_t* options - options of the filters.
+ */
+void print_tiling_benchmark(const char* name, uint8_t* img, int width,
+                            int height, int window_size,
+                            int sim_window_size, double stdev,
+                            nlm_options_t* options)
+{
+    const char* names[] = {"rows", "tiles"};
+    uint8_t* filtered = (uint8_t*) calloc(width*height, sizeof(uint8_t));
+    int counter = open_cache_miss_counter();
+
+    if (filtered == NULL)
+    {
+        printf("Unable to allocate memory for the benchmark.\n");
+        exit(1);
+    }
+
+    for (int k = 0; k < 2; k++)
+    {
+        struct timespec start, end;
+        long long misses = -1;
+
+#ifdef __linux__
+        if (counter >= 0)
+        {
+            ioctl(counter, PERF_EVENT_IOC_RESET, 0);
+            ioctl(counter, PERF_EVENT_IOC_ENABLE, 0);
+        }
+#endif
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        if (k == 0)
+        {
+            nlm_filter(img, filtered, width, height, 0, height, window_size, sim_window_size, stdev, options->lut, options->preselect ? &options->thresholds : NULL, options->threads);
+        } else
+        {
+            nlm_filter_tiled(img, filtered, width, height, 0, height, window_size, sim_window_size, stdev, options->lut, options->preselect ? &options->thresholds : NULL, options->threads);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+#ifdef __linux__
+        if (counter >= 0)
+        {
+            ioctl(counter, PERF_EVENT_IOC_DISABLE, 0);
+
+            if (read(counter, &misses, sizeof(misses)) != sizeof(misses))
+            {
+                misses = -1;
+            }
+        }
+#endif
+
+        double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec)*1e-9;
+
+        if (misses >= 0)
+        {
+            printf("%s: %s %.3f s, %lld cache misses\n", name, names[k], seconds, misses);
+        } else
+        {
+            printf("%s: %s %.3f s, cache misses not available\n", name, names[k], seconds);
+        }
+    }
+
+    printf("%s: tiles of %d x %d pixels\n", name, get_tile_size(window_size, sim_window_size),
+           get_tile_size(window_size, sim_window_size));
+
+    if (counter >= 0)
+    {
+        close(counter);
+    }
+
+    free(filtered);
+}
+
+/**
+ * This function filters an image with every standard deviation of
+ * --sigmas at once and saves one image per standard deviation, named
+ * after the prefix, the index of the image and the standard deviation.
+ * With --report every image is compared against nlm_filter_integral
+ * with its standard deviation and exact weights.
+ *
+ * Params:
+ *      const char* name - name of the image.
+ *      const char* prefix - path and name of the saved images.
+ *      int index - index of the image in the arguments.
+ *      uint8_t* img - image to filter.
+ *      int width - number of cols.
+ *      int height - number of rows.
+ *      int window_size - size of the window.
+ *      int sim_window_size - size of the similarity window.
+ *      nlm_options_t* options - standard deviations and options.
+ */
+void run_sigma_sweep(const char* name, const char* prefix, int index,
+                     uint8_t* img, int width, int height, int window_size,
+                     int sim_window_size, nlm_options_t* options)
+{
+    int sigmas = options->sigma_count;
+    uint8_t* filtered[NLM_MAX_SIGMAS];
+
+    for (int s = 0; s < sigmas; s++)
+    {
+        filtered[s] = (uint8_t*) calloc(width*height, sizeof(uint8_t));
+
+        if (filtered[s] == NULL)
+        {
+            printf("Unable to allocate memory for the filtered images.\n");
+            exit(1);
+        }
+    }
+
+    nlm_filter_sigmas(img, filtered, width, height, window_size, sim_window_size, options->sigmas, sigmas, options->lut, options->threads);
+
+    for (int s = 0; s < sigmas; s++)
+    {
+        if (options->report)
+        {
+            uint8_t* reference = (uint8_t*) calloc(width*height, sizeof(uint8_t));
+
+            if (reference == NULL)
+            {
+                printf("Unable to allocate memory for the reference image.\n");
+                exit(1);
+            }
+
+            // Compare against the filter with this standard deviation
+            printf("sigma %g: ", options->sigmas[s]);
+
+            if (options->lut)
+            {
+                // Error of the weight table of this standard deviation
+                // against exp
+                print_lut_error(window_size, options->sigmas[s]);
+                printf("sigma %g: ", options->sigmas[s]);
+            }
+            nlm_filter_integral(img, reference, width, height, 0, height, window_size, sim_window_size, options->sigmas[s], 0, options->threads);
+            print_accuracy_report(name, reference, filtered[s], width, height, window_size);
+
+            free(reference);
+        }
+
+        char output[64];
+        snprintf(output, sizeof(output), "%s%d-sigma%g.png", prefix, index, options->sigmas[s]);
+
+        // Save image
+        stbi_write_jpg(output, width, height, 1, filtered[s], width);
+
+        free(filtered[s]);
+    }
+}
+
+/**
+ * This function loads an image, filters it with the selected filter
+ * and saves it, all in this rank.
+ *
+ * Params:
+ *      const char* path - path of the image.
+ *      int index - index of the image in the arguments, it names the
+ *                  output.
+ *      int window_size - size of the window.
+ *      int sim_window_size - size of the similarity window.
+ *      double stdev - standard deviation of the gaussian
+ *                     distribution.
+ *      nlm_options_t* options - filter implementation and its options.
+ *
+ * Returns:
+ *      int - 1 if the image was filtered, 0 if it could not be
+ *            loaded.
+ */
+int filter_image(const char* path, int index, int window_size,
+                 int sim_window_size, double stdev, nlm_options_t* options)
+{
+    int width, height, channels;
+
+    // Load image
+    uint8_t* rgb_img = stbi_load(path, &width, &height, &channels, 3);
+
+    if (rgb_img == NULL)
+    {
+        printf("Error loading the image in %s.\n", path);
+        return 0;
+    }
+
+    // Convert image to gray
+    size_t img_size = width*height*3;
+    size_t gray_img_size = width*height;
+
+    uint8_t* gray_img = (uint8_t*) calloc(gray_img_size, sizeof(uint8_t));
+
+    if (gray_img == NULL)
+    {
+        printf("Unable to allocate memory for the gray image.\n");
+        // Terminate MPI execution environment
+        MPI_Finalize();
+        exit(1);
+    }
+
+    kernels.rgb2gray(rgb_img, gray_img, img_size);
+
+    if (options->sigma_count > 0)
+    {
+        // One image per standard deviation, every distance is
+        // computed once
+        run_sigma_sweep(path, "outputs/nlm_mpi", index, gray_img, width, height, window_size, sim_window_size, options);
+
+        // Free memory
+        stbi_image_free(rgb_img);
+        stbi_image_free(gray_img);
+        return 1;
+    }
+
+    // Allocate memory for the filtered image
+    uint8_t* filtered_img = (uint8_t*) calloc(gray_img_size, sizeof(uint8_t));
+
+    if (filtered_img == NULL)
+    {
+        printf("Unable to allocate memory for the filtered image.\n");
+        // Terminate MPI execution environment
+        MPI_Finalize();
+        exit(1);
+    }
+
+    // Non-Local Means filtering
+    apply_nlm_filter(gray_img, filtered_img, width, height, 0, height, window_size, sim_window_size, stdev, options);
+
+    if (options->report)
+    {
+        // Allocate memory for the reference image
+        uint8_t* reference_img = (uint8_t*) calloc(gray_img_size, sizeof(uint8_t));
+
+        if (reference_img == NULL)
+        {
+            printf("Unable to allocate memory for the reference image.\n");
+            // Terminate MPI execution environment
+            MPI_Finalize();
+            exit(1);
+        }
+
+        // Compare against the filter with exact weights
+        nlm_filter_integral(gray_img, reference_img, width, height, 0, height, window_size, sim_window_size, stdev, 0, options->threads);
+        print_accuracy_report(path, reference_img, filtered_img, width, height, window_size);
+
+        free(reference_img);
+    }
+
+    if (options->benchmark)
+    {
+        print_tiling_benchmark(path, gray_img, width, height, window_size, sim_window_size, stdev, options);
+    }
+
+    char output[25];
+    sprintf(output, "%s%d%s", "outputs/nlm_mpi", index, ".png");
+
+    // Save image
+    stbi_write_jpg(output, width, height, 1, filtered_img, width);
+
+    // Free memory
+    stbi_image_free(rgb_img);
+    stbi_image_free(gray_img);
+    stbi_image_free(filtered_img);
+
+    return 1;
+}
+
+// Tag of the halo rows exchanged between the strips
+#define TAG_HALO 3
+
+/**
+ * This function filters some rows of a strip. Only the given rows are
+ * filtered and only the rows their windows reach are read, so rows of
+ * the strip that have not arrived yet are never read.
+ *
+ * Params:
+ *      uint8_t* strip - strip to filter.
+ *      uint8_t* filtered_strip - pointer to the filtered strip.
+ *      int width - number of cols.
+ *      int strip_rows - number of rows of the strip.
+ *      int first - first row to filter.
+ *      int last - row after the last row to filter.
+ *      int halo_top - rows read above a filtered row.
+ *      int halo_bottom - rows read below a filtered row.
+ *      int window_size - size of the window.
+ *      int sim_window_size - size of the similarity window.
+ *      double stdev - standard deviation of the gaussian
+ *                     distribution.
+ *      nlm_options_t* options - filter implementation and its options.
+ */
+void nlm_filter_strip_rows(uint8_t* strip, uint8_t* filtered_strip,
+                           int width, int strip_rows, int first, int last,
+                           int halo_top, int halo_bottom, int window_size,
+                           int sim_window_size, double stdev,
+                           nlm_options_t* options)
+{
+    int input_first = MAX(first - halo_top, 0);
+    int input_last = MIN(last + halo_bottom, strip_rows);
+
+    // Get memory for the filtered rows and the rows read around them
+    uint8_t* filtered_rows = (uint8_t*) calloc((input_last - input_first)*width, sizeof(uint8_t));
+
+    if (filtered_rows == NULL)
+    {
+        printf("Unable to allocate memory for the strip.\n");
+        // Terminate MPI execution environment
+        MPI_Finalize();
+        exit(1);
+    }
+
+    apply_nlm_filter(strip + input_first*width, filtered_rows, width, input_last - input_first, first - input_first, last - input_first, window_size, sim_window_size, stdev, options);
+
+    memcpy(filtered_strip + first*width, filtered_rows + (first - input_first)*width, (last - first)*width);
+
+    // Free memory
+    free(filtered_rows);
+}
+
+/**
+ * This function filters an image split in strips of rows across all
+ * the ranks. Rank 0 sends every rank the rows it owns, and the ranks
+ * exchange with non-blocking messages the halo rows the windows of the
+ * candidates need above and below every strip. While the halos are in
+ * flight every rank filters the interior rows of its strip, which do
+ * not read them, and it filters the border rows once they arrive.
+ * Rank 0 gathers the filtered rows. The blockwise, PCA and PatchMatch
+ * filters depend on the rows they are given, so their result depends
+ * on the number of ranks.
+ *
+ * Params:
+ *      uint8_t* img - image to filter, only read on rank 0.
+ *      uint8_t* filtered - pointer to the filtered image, only written
+ *                          on rank 0.
+ *      int width - number of cols.
+ *      int height - number of rows.
+ *      int window_size - size of the window.
+ *      int sim_window_size - size of the similarity window.
+ *      double stdev - standard deviation of the gaussian
+ *                     distribution.
+ *      nlm_options_t* options - filter implementation and its options.
+ *      int rank - rank of this process.
+ *      int total_ranks - number of ranks.
+ */
+void nlm_filter_strips(uint8_t* img, uint8_t* filtered, int width,
+                       int height, int window_size, int sim_window_size,
+                       double stdev, nlm_options_t* options, int rank,
+                       int total_ranks)
 {
-    uint8_t* img_ptr = img;
+    // Get the middle of the windows
+    int mid_window = (int) (window_size - 1)/2;
+    int mid_sim_window = (int) (sim_window_size - 1)/2;
 
-    while (img_ptr != img + img_size)
+    // Rows needed above and below a strip, the candidates are up to
+    // mid_sim_window rows away and their windows cover mid_window rows
+    // more
+    int halo_top = mid_sim_window + mid_window;
+    int halo_bottom = mid_sim_window + window_size - 1 - mid_window;
+
+    // Rows owned by every rank and its rows with the halos
+    int* first_rows = (int*) calloc(total_ranks, sizeof(int));
+    int* last_rows = (int*) calloc(total_ranks, sizeof(int));
+    int* halo_first_rows = (int*) calloc(total_ranks, sizeof(int));
+    int* halo_last_rows = (int*) calloc(total_ranks, sizeof(int));
+    int* owned_counts = (int*) calloc(total_ranks, sizeof(int));
+    int* owned_displacements = (int*) calloc(total_ranks, sizeof(int));
+
+    // A receive and a send at most with every other rank
+    MPI_Request* requests = (MPI_Request*) calloc(2*total_ranks, sizeof(MPI_Request));
+
+    if (first_rows == NULL || last_rows == NULL || halo_first_rows == NULL ||
+        halo_last_rows == NULL || owned_counts == NULL ||
+        owned_displacements == NULL || requests == NULL)
     {
-        // Convert RGB pixel to gray
-        *gray_ptr = (uint8_t)(0.3*(*img_ptr) + 0.59*(*(img_ptr + 1)) + 0.11*(*(img_ptr + 2)));
+        printf("Unable to allocate memory for the strips.\n");
+        // Terminate MPI execution environment
+        MPI_Finalize();
+        exit(1);
+    }
 
-        // Next pixel
-        img_ptr += 3;
-        gray_ptr++;
+    for (int r = 0; r < total_ranks; r++)
+    {
+        first_rows[r] = (int) ((long) height*r/total_ranks);
+        last_rows[r] = (int) ((long) height*(r + 1)/total_ranks);
+        halo_first_rows[r] = MAX(first_rows[r] - halo_top, 0);
+        halo_last_rows[r] = MIN(last_rows[r] + halo_bottom, height);
+        owned_counts[r] = (last_rows[r] - first_rows[r])*width;
+        owned_displacements[r] = first_rows[r]*width;
+    }
+
+    int first = first_rows[rank];
+    int last = last_rows[rank];
+    int halo_first = halo_first_rows[rank];
+    int strip_rows = halo_last_rows[rank] - halo_first;
+
+    // Get memory for the strip and its filtered rows
+    uint8_t* strip = (uint8_t*) calloc(MAX(strip_rows*width, 1), sizeof(uint8_t));
+    uint8_t* filtered_strip = (uint8_t*) calloc(MAX(strip_rows*width, 1), sizeof(uint8_t));
+
+    if (strip == NULL || filtered_strip == NULL)
+    {
+        printf("Unable to allocate memory for the strip.\n");
+        // Terminate MPI execution environment
+        MPI_Finalize();
+        exit(1);
+    }
+
+    // Rows owned by this rank inside the strip
+    uint8_t* owned = strip + (first - halo_first)*width;
+    uint8_t* filtered_owned = filtered_strip + (first - halo_first)*width;
+
+    MPI_Scatterv(img, owned_counts, owned_displacements, MPI_UINT8_T, owned, owned_counts[rank], MPI_UINT8_T, 0, MPI_COMM_WORLD);
+
+    // Post the halo exchange, the rows of a halo may come from more
+    // than one rank when the strips are thinner than the halos
+    int request_count = 0;
+
+    for (int r = 0; r < total_ranks; r++)
+    {
+        if (r == rank)
+        {
+            continue;
+        }
+
+        // Rows of the halos of this rank owned by rank r
+        int receive_first = MAX(halo_first, first_rows[r]);
+        int receive_last = MIN(halo_last_rows[rank], last_rows[r]);
+
+        if (receive_first < receive_last)
+        {
+            MPI_Irecv(strip + (receive_first - halo_first)*width, (receive_last - receive_first)*width, MPI_UINT8_T, r, TAG_HALO, MPI_COMM_WORLD, &requests[request_count++]);
+        }
+
+        // Rows owned by this rank in the halos of rank r
+        int send_first = MAX(first, halo_first_rows[r]);
+        int send_last = MIN(last, halo_last_rows[r]);
+
+        if (send_first < send_last)
+        {
+            MPI_Isend(strip + (send_first - halo_first)*width, (send_last - send_first)*width, MPI_UINT8_T, r, TAG_HALO, MPI_COMM_WORLD, &requests[request_count++]);
+        }
+    }
+
+    // Interior rows of the strip, relative to it, whose windows do not
+    // reach the halos
+    int owned_first = first - halo_first;
+    int owned_last = last - halo_first;
+    int interior_first = owned_first + (first > 0 ? halo_top : 0);
+    int interior_last = owned_last - (last < height ? halo_bottom : 0);
+
+    if (interior_first < interior_last)
+    {
+        // Filter the interior while the halos arrive, it reads only the
+        // owned rows
+        nlm_filter_strip_rows(owned, filtered_owned, width, last - first, interior_first - owned_first, interior_last - owned_first, halo_top, halo_bottom, window_size, sim_window_size, stdev, options);
     }
+
+    MPI_Waitall(request_count, requests, MPI_STATUSES_IGNORE);
+
+    if (interior_first >= interior_last)
+    {
+        // The strip is too thin to have an interior
+        if (owned_first < owned_last)
+        {
+            nlm_filter_strip_rows(strip, filtered_strip, width, strip_rows, owned_first, owned_last, halo_top, halo_bottom, window_size, sim_window_size, stdev, options);
+        }
+    } else
+    {
+        // Filter the border rows with the halos
+        if (owned_first < interior_first)
+        {
+            nlm_filter_strip_rows(strip, filtered_strip, width, strip_rows, owned_first, interior_first, halo_top, halo_bottom, window_size, sim_window_size, stdev, options);
+        }
+
+        if (interior_last < owned_last)
+        {
+            nlm_filter_strip_rows(strip, filtered_strip, width, strip_rows, interior_last, owned_last, halo_top, halo_bottom, window_size, sim_window_size, stdev, options);
+        }
+    }
+
+    // Only the rows owned by every rank go back
+    MPI_Gatherv(filtered_owned, owned_counts[rank], MPI_UINT8_T, filtered, owned_counts, owned_displacements, MPI_UINT8_T, 0, MPI_COMM_WORLD);
+
+    // Free memory
+    free(first_rows);
+    free(last_rows);
+    free(halo_first_rows);
+    free(halo_last_rows);
+    free(owned_counts);
+    free(owned_displacements);
+    free(requests);
+    free(strip);
+    free(filtered_strip);
 }
 
 /**
- * This function extracts a window of size x size from an image.
+ * This function loads an image on rank 0, filters it split in strips
+ * of rows across all the ranks and saves it from rank 0. Every rank
+ * must call it for every image.
  *
  * Params:
- *      uint8_t* img - image.
- *      uint8_t* window - pointer to store the windows.
- *      int i - row in the image to extract the window (center of the
- *              window).
- *      int j - column in the image to extract the window (center of
- *              the window).
- *      int width - number of columns in the image.
- *      int size - size of the window.
+ *      const char* path - path of the image.
+ *      int index - index of the image in the arguments, it names the
+ *                  output.
+ *      int window_size - size of the window.
+ *      int sim_window_size - size of the similarity window.
+ *      double stdev - standard deviation of the gaussian
+ *                     distribution.
+ *      nlm_options_t* options - filter implementation and its options.
+ *      int rank - rank of this process.
+ *      int total_ranks - number of ranks.
+ *
+ * Returns:
+ *      int - 1 if the image was filtered, 0 if it could not be
+ *            loaded.
  */
-void get_window(uint8_t* img, uint8_t* window, int i, int j, int width,
-                int size)
+int filter_image_strips(const char* path, int index, int window_size,
+                        int sim_window_size, double stdev,
+                        nlm_options_t* options, int rank, int total_ranks)
 {
-    // Get the middle of the window
-    int mid = (int) (size - 1)/2;
+    // Width and height, 0 if the image could not be loaded
+    int size[2] = {0, 0};
+    uint8_t* rgb_img = NULL;
+    uint8_t* gray_img = NULL;
+    uint8_t* filtered_img = NULL;
+
+    if (rank == 0)
+    {
+        int channels;
+
+        // Load image
+        rgb_img = stbi_load(path, &size[0], &size[1], &channels, 3);
+
+        if (rgb_img == NULL)
+        {
+            printf("Error loading the image in %s.\n", path);
+            size[0] = size[1] = 0;
+        } else
+        {
+            // Convert image to gray
+            size_t img_size = size[0]*size[1]*3;
+            size_t gray_img_size = size[0]*size[1];
+
+            gray_img = (uint8_t*) calloc(gray_img_size, sizeof(uint8_t));
+            filtered_img = (uint8_t*) calloc(gray_img_size, sizeof(uint8_t));
+
+            if (gray_img == NULL || filtered_img == NULL)
+            {
+                printf("Unable to allocate memory for the image.\n");
+                // Terminate MPI execution environment
+                MPI_Finalize();
+                exit(1);
+            }
+
+            kernels.rgb2gray(rgb_img, gray_img, img_size);
+        }
+    }
 
-    for (int m = -mid; m < mid + 1; m++)
+    MPI_Bcast(size, 2, MPI_INT, 0, MPI_COMM_WORLD);
+
+    if (size[0] == 0)
+    {
+        return 0;
+    }
+
+    // Non-Local Means filtering
+    nlm_filter_strips(gray_img, filtered_img, size[0], size[1], window_size, sim_window_size, stdev, options, rank, total_ranks);
+
+    if (rank == 0)
     {
-        for (int n = -mid; n < mid + 1; n++)
+        if (options->report)
+        {
+            // Allocate memory for the reference image
+            uint8_t* reference_img = (uint8_t*) calloc(size[0]*size[1], sizeof(uint8_t));
+
+            if (reference_img == NULL)
+            {
+                printf("Unable to allocate memory for the reference image.\n");
+                // Terminate MPI execution environment
+                MPI_Finalize();
+                exit(1);
+            }
+
+            // Compare against the filter with exact weights
+            nlm_filter_integral(gray_img, reference_img, size[0], size[1], 0, size[1], window_size, sim_window_size, stdev, 0, options->threads);
+            print_accuracy_report(path, reference_img, filtered_img, size[0], size[1], window_size);
+
+            free(reference_img);
+        }
+
+        if (options->benchmark)
         {
-            // Store the image pixel in the window
-            *window = *(img + i*width + m + j + n);
-            window++;
+            print_tiling_benchmark(path, gray_img, size[0], size[1], window_size, sim_window_size, stdev, options);
         }
+
+        char output[25];
+        sprintf(output, "%s%d%s", "outputs/nlm_mpi", index, ".png");
+
+        // Save image
+        stbi_write_jpg(output, size[0], size[1], 1, filtered_img, size[0]);
+
+        // Free memory
+        stbi_image_free(rgb_img);
+        stbi_image_free(gray_img);
+        stbi_image_free(filtered_img);
     }
+
+    return 1;
 }
 
 /**
- * This function substracts two kernels.
+ * This function assigns the images to the ranks before filtering them.
+ * Rank 0 reads the size of every image from its header, without
+ * decoding it, estimates its cost as its pixels times the cost of a
+ * pixel and gives the images, from the most to the least expensive, to
+ * the rank with the least work so far (longest processing time first).
+ * The assignment is then sent to every rank.
  *
  * Params:
- *      uint8_t* v - first kernel.
- *      uint8_t* u - second kernel.
- *      double* result_window - result of the operation.
- *      int size - size of the window
+ *      int argc - number of arguments.
+ *      char* argv[] - arguments.
+ *      int first - index of the first image in the arguments.
+ *      double pixel_cost - estimated cost of filtering a pixel.
+ *      int* owners - pointer to store the rank that filters every
+ *                    image, argc - first values.
+ *      int rank - rank of this process.
+ *      int total_ranks - number of ranks.
  */
-void substract(uint8_t* v, uint8_t* u, double* result_window, int size)
+void schedule_images_lpt(int argc, char* argv[], int first,
+                         double pixel_cost, int* owners, int rank,
+                         int total_ranks)
 {
-    for (int i = 0; i < size; i++)
+    int count = argc - first;
+
+    if (rank == 0)
     {
-        for (int j = 0; j < size; j++)
+        double* costs = (double*) calloc(count, sizeof(double));
+        int* order = (int*) calloc(count, sizeof(int));
+        double* loads = (double*) calloc(total_ranks, sizeof(double));
+
+        if (costs == NULL || order == NULL || loads == NULL)
         {
-            // Substract and store the result
-            result_window[i*size + j] = ((double) v[i*size + j]) - ((double) u[i*size + j]);
+            printf("Unable to allocate memory for the schedule.\n");
+            // Terminate MPI execution environment
+            MPI_Finalize();
+            exit(1);
+        }
+
+        for (int k = 0; k < count; k++)
+        {
+            int width, height, channels;
+
+            // Images that can not be read cost nothing, their owner
+            // reports the error
+            if (stbi_info(argv[first + k], &width, &height, &channels))
+            {
+                costs[k] = (double) width*height*pixel_cost;
+            }
+
+            // Keep the images sorted from the most expensive
+            int position = k;
+
+            for (; position > 0 && costs[order[position - 1]] < costs[k]; position--)
+            {
+                order[position] = order[position - 1];
+            }
+
+            order[position] = k;
+        }
+
+        for (int k = 0; k < count; k++)
+        {
+            int least = 0;
+
+            for (int r = 1; r < total_ranks; r++)
+            {
+                if (loads[r] < loads[least])
+                {
+                    least = r;
+                }
+            }
+
+            owners[order[k]] = least;
+            loads[least] += costs[order[k]];
         }
+
+        free(costs);
+        free(order);
+        free(loads);
     }
+
+    MPI_Bcast(owners, count, MPI_INT, 0, MPI_COMM_WORLD);
 }
 
+// Tags of the messages of the dynamic distribution
+#define TAG_REQUEST 1
+#define TAG_IMAGE 2
+
 /**
- * This function computes the norm of a kernel as a flatten vector.
+ * This function distributes the images on demand. Rank 0 hands out the
+ * index of the next image to every worker that asks for one, and the
+ * workers ask again as soon as they finish, so a rank that gets large
+ * images simply takes fewer of them. When there are no images left
+ * every worker gets -1. With a single rank it filters all the images.
  *
  * Params:
- *      double* v - kernel to use.
- *      int size - size of the kernel.
+ *      int argc - number of arguments.
+ *      char* argv[] - arguments, the images start at argv[4].
+ *      int window_size - size of the window.
+ *      int sim_window_size - size of the similarity window.
+ *      double stdev - standard deviation of the gaussian
+ *                     distribution.
+ *      nlm_options_t* options - filter implementation and its options.
+ *      int rank - rank of this process.
+ *      int total_ranks - number of ranks.
+ *      double* busy - seconds this rank spent filtering.
+ *      int* images - number of images this rank filtered.
  */
-double norm(double* v, int size)
+void filter_images_dynamic(int argc, char* argv[], int window_size, int sim_window_size,
+                           double stdev, nlm_options_t* options,
+                           int rank, int total_ranks, double* busy,
+                           int* images)
 {
-    double sum = 0.0;
-
-    for (int i = 0; i < size; i++)
+    if (total_ranks < 2)
     {
-        for (int j = 0; j < size; j++)
+        for (int i = 4; i < argc; i++)
         {
-            // Sum of squares
-            sum += pow(v[i*size + j], 2.0);
+            double start = MPI_Wtime();
+
+            int filtered = filter_image(argv[i], i - 4, window_size, sim_window_size, stdev, options);
+            *busy += MPI_Wtime() - start;
+            *images += filtered;
         }
+
+        return;
     }
 
-    // Compute the square root to get the result
-    return sqrt(sum);
+    if (rank == 0)
+    {
+        int next = 4;
+        int stopped = 0;
+
+        // Answer the requests until every worker was told to stop
+        while (stopped < total_ranks - 1)
+        {
+            MPI_Status status;
+            int request;
+
+            MPI_Recv(&request, 1, MPI_INT, MPI_ANY_SOURCE, TAG_REQUEST, MPI_COMM_WORLD, &status);
+
+            int index = next < argc ? next++ : -1;
+
+            if (index < 0)
+            {
+                stopped++;
+            }
+
+            MPI_Send(&index, 1, MPI_INT, status.MPI_SOURCE, TAG_IMAGE, MPI_COMM_WORLD);
+        }
+    } else
+    {
+        while (1)
+        {
+            int index;
+
+            // Ask for the next image
+            MPI_Send(&rank, 1, MPI_INT, 0, TAG_REQUEST, MPI_COMM_WORLD);
+            MPI_Recv(&index, 1, MPI_INT, 0, TAG_IMAGE, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+
+            if (index < 0)
+            {
+                break;
+            }
+
+            double start = MPI_Wtime();
+
+            int filtered = filter_image(argv[index], index - 4, window_size, sim_window_size, stdev, options);
+            *busy += MPI_Wtime() - start;
+            *images += filtered;
+        }
+    }
 }
 
 /**
- * This function performs a non-local means filtering on an image.
+ * This function distributes the images on demand without a master. The
+ * index of the next image is a counter in a window of rank 0, and every
+ * rank, rank 0 included, claims an image incrementing it atomically
+ * with MPI_Fetch_and_op until it runs past the last image.
  *
  * Params:
- *      uint8_t* img - image to filter.
- *      uint8_t* filtered - pointer to the filtered image.
- *      int width - number of cols.
- *      int height - number of rows.
+ *      int argc - number of arguments.
+ *      char* argv[] - arguments, the images start at argv[4].
  *      int window_size - size of the window.
  *      int sim_window_size - size of the similarity window.
  *      double stdev - standard deviation of the gaussian
  *                     distribution.
+ *      nlm_options_t* options - filter implementation and its options.
+ *      int rank - rank of this process.
+ *      double* busy - seconds this rank spent filtering.
+ *      int* images - number of images this rank filtered.
  */
-void nlm_filter(uint8_t* img, uint8_t* filtered, int width, int height,
-                int window_size, int sim_window_size, double stdev)
+void filter_images_counter(int argc, char* argv[], int window_size, int sim_window_size,
+                           double stdev, nlm_options_t* options,
+                           int rank, double* busy, int* images)
 {
-    // Get the middle of the windows
-    int mid_window = (int) (window_size - 1)/2;
-    int mid_sim_window = (int) (sim_window_size - 1)/2;
+    int* counter;
+    MPI_Win window;
 
-    // Get memory for the windows
-    uint8_t* window = (uint8_t*) calloc(window_size*window_size, sizeof(uint8_t));
-    uint8_t* sim_window = (uint8_t*) calloc(window_size*window_size, sizeof(uint8_t));
-    double* result_window = (double*) calloc(window_size*window_size, sizeof(double));
+    // The counter lives in rank 0, the other ranks expose no memory
+    MPI_Win_allocate(rank == 0 ? sizeof(int) : 0, sizeof(int), MPI_INFO_NULL, MPI_COMM_WORLD, &counter, &window);
 
-    for (int i = mid_window; i < height - mid_window; i++)
+    if (rank == 0)
     {
-        for (int j = mid_window; j < width - mid_window; j++)
-        {
-            double sum = 0.0;
+        MPI_Win_lock(MPI_LOCK_EXCLUSIVE, 0, 0, window);
+        *counter = 4;
+        MPI_Win_unlock(0, window);
+    }
 
-            // Get the window from the image
-            get_window(img, window, i, j, width, window_size);
+    // No rank claims an image before the counter is set
+    MPI_Barrier(MPI_COMM_WORLD);
 
-            // Values for the similarity window
-            int umin = MAX(i - mid_sim_window, mid_window);
-            int umax = MIN(i + mid_sim_window, height - mid_window);
-            int vmin = MAX(j - mid_sim_window, mid_window);
-            int vmax = MIN(j + mid_sim_window, width - mid_window);
+    while (1)
+    {
+        int one = 1;
+        int index;
 
-            double normalization_factor = 0.0;
+        // Claim the next image
+        MPI_Win_lock(MPI_LOCK_SHARED, 0, 0, window);
+        MPI_Fetch_and_op(&one, &index, MPI_INT, 0, 0, MPI_SUM, window);
+        MPI_Win_unlock(0, window);
 
-            // Compare window against the similarity window
-            for (int u = umin; u < umax + 1; u++)
-            {
-                for (int v = vmin; v < vmax + 1; v++)
-                {
-                    // Get the similarity window from the image
-                    get_window(img, sim_window, u, v, width, window_size);
+        if (index >= argc)
+        {
+            break;
+        }
 
-                    // Similarity between pixels
-                    substract(window, sim_window, result_window, window_size);
-                    double norm_value = norm(result_window, window_size);
-                    double similarity = exp(-norm_value/pow(stdev, 2.0));
+        double start = MPI_Wtime();
 
-                    normalization_factor += similarity;
-                    sum += similarity*img[u*width + v];
-                }
-            }
+        int filtered = filter_image(argv[index], index - 4, window_size, sim_window_size, stdev, options);
+        *busy += MPI_Wtime() - start;
+        *images += filtered;
+    }
 
-            // Normalize the resulting pixel
-            double result = sum/normalization_factor;
-            uint8_t value = 0;
+    MPI_Win_free(&window);
+}
 
-            // Keep the pixel value between 0 and 255, avoiding
-            // unexpected values
-            if (result > 255)
-            {
-                value = 255;
-            } else if (result > 0)
-            {
-                value = (uint8_t) round(result);
-            }
+/**
+ * This function prints on rank 0 how many images every rank filtered
+ * and how long it was busy filtering them, so an unbalanced
+ * distribution shows up as ranks busy for much less than the others.
+ *
+ * Params:
+ *      double busy - seconds this rank spent filtering.
+ *      int images - number of images this rank filtered.
+ *      int rank - rank of this process.
+ *      int total_ranks - number of ranks.
+ */
+void print_busy_summary(double busy, int images, int rank, int total_ranks)
+{
+    double* all_busy = NULL;
+    int* all_images = NULL;
 
-            filtered[i*width + j] = value;
+    if (rank == 0)
+    {
+        all_busy = (double*) calloc(total_ranks, sizeof(double));
+        all_images = (int*) calloc(total_ranks, sizeof(int));
+
+        if (all_busy == NULL || all_images == NULL)
+        {
+            printf("Unable to allocate memory for the summary.\n");
+            // Terminate MPI execution environment
+            MPI_Finalize();
+            exit(1);
         }
     }
 
-    // Free memory
-    free(window);
-    free(sim_window);
-    free(result_window);
-}
+    MPI_Gather(&busy, 1, MPI_DOUBLE, all_busy, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    MPI_Gather(&images, 1, MPI_INT, all_images, 1, MPI_INT, 0, MPI_COMM_WORLD);
+
+    if (rank == 0)
+    {
+        for (int r = 0; r < total_ranks; r++)
+        {
+            printf("Rank %d: %d images, busy %.3f s.\n", r, all_images[r], all_busy[r]);
+        }
 
+        free(all_busy);
+        free(all_images);
+    }
+}
 
 int main(int argc, char* argv[])
 {
+    nlm_options_t options;
+
+    // Remove the options from the arguments
+    argc = parse_options(argc, argv, &options);
+
     if (argc < 5)
     {
-        printf("Args were not provided. `make nlm-mpi w=3 sw=7 sigma=2.0 imgs=\"img1 img2 img3 etc\"`.\n");
+        printf("Args were not provided. `make nlm-mpi w=3 sw=7 sigma=2.0 imgs=\"img1 img2 img3 etc\" opts=\"--mode=integral|direct|symmetric|tiled|blockwise|pca|sweep|patchmatch|float --step=2 --pca-dims=8 --neighbors=16 --sigmas=5,10,20 --preselect --mean-threshold=8 --variance-ratio=2 --lut --report --benchmark --threads=1 --distribute=lpt|images|strips|dynamic|counter --isa=scalar|sse2|avx2|avx512\"`.\n");
     }
     else
     {
@@ -226,61 +4535,103 @@ int main(int argc, char* argv[])
         int sim_win_size = atoi(argv[2]);
         float sigma = atof(argv[3]);
 
-        for (int i = 4 + rank; i < argc; i += total_ranks)
+        // Bind the kernels to the instruction set of this node
+        const char* isa = select_kernels(options.isa, win_size);
+        printf("Rank %d on %s: using %s kernels.\n", rank, name, isa);
+
+        if (rank == 0 && options.report && options.lut && options.sigma_count == 0)
         {
-            int width, height, channels;
+            // Error of the weight table against exp, --sigmas
+            // reports the table of every sigma
+            print_lut_error(win_size, sigma);
+        }
 
-            // Load image
-            uint8_t* rgb_img = stbi_load(argv[i], &width, &height, &channels, 3);
+        // Time spent filtering and images filtered by this rank
+        double busy = 0.0;
+        int images = 0;
 
-            if (rgb_img == NULL)
+        if (options.distribution == DISTRIBUTE_STRIPS && options.sigma_count > 0)
+        {
+            // The sigma sweep filters whole images, balance them instead
+            if (rank == 0)
             {
-                printf("Error loading the image in %s.\n", argv[i]);
-                continue;
+                printf("--sigmas filters whole images, distributing them as with --distribute=lpt.\n");
             }
 
-            // Convert image to gray
-            size_t img_size = width*height*channels;
-            size_t gray_img_size = width*height;
+            options.distribution = DISTRIBUTE_LPT;
+        }
 
-            uint8_t* gray_img = (uint8_t*) calloc(gray_img_size, sizeof(uint8_t));
+        if (rank == 0 && options.distribution == DISTRIBUTE_STRIPS &&
+            (options.mode == NLM_BLOCKWISE || options.mode == NLM_PCA || options.mode == NLM_PATCHMATCH))
+        {
+            printf("The result of this mode depends on the number of strips.\n");
+        }
 
-            if (gray_img == NULL)
+        if (options.distribution == DISTRIBUTE_STRIPS)
+        {
+            // Every rank filters a strip of rows of every image
+            for (int i = 4; i < argc; i++)
             {
-                printf("Unable to allocate memory for the gray image.\n");
-                // Terminate MPI execution environment
-                MPI_Finalize();
-                exit(1);
-            }
-
-            rgb2gray(rgb_img, gray_img, img_size);
+                double start = MPI_Wtime();
 
-            // Allocate memory for the filtered image
-            uint8_t* filtered_img = (uint8_t*) calloc(gray_img_size, sizeof(uint8_t));
+                int filtered = filter_image_strips(argv[i], i - 4, win_size, sim_win_size, sigma, &options, rank, total_ranks);
+                busy += MPI_Wtime() - start;
+                images += filtered;
+            }
+        } else if (options.distribution == DISTRIBUTE_LPT)
+        {
+            // Rank that filters every image
+            int* owners = (int*) calloc(argc - 4, sizeof(int));
 
-            if (filtered_img == NULL)
+            if (owners == NULL)
             {
-                printf("Unable to allocate memory for the filtered image.\n");
+                printf("Unable to allocate memory for the schedule.\n");
                 // Terminate MPI execution environment
                 MPI_Finalize();
                 exit(1);
             }
 
-            // Non-Local Means filtering
-            nlm_filter(gray_img, filtered_img, width, height, win_size, sim_win_size, sigma);
+            // Balance the estimated cost of the images among the ranks
+            schedule_images_lpt(argc, argv, 4, (double) sim_win_size*sim_win_size*win_size*win_size, owners, rank, total_ranks);
+
+            for (int i = 4; i < argc; i++)
+            {
+                if (owners[i - 4] != rank)
+                {
+                    continue;
+                }
+
+                double start = MPI_Wtime();
 
-            char output[25];
-            sprintf(output, "%s%d%s", "outputs/nlm_mpi", i - 4, ".png");
+                int filtered = filter_image(argv[i], i - 4, win_size, sim_win_size, sigma, &options);
+                busy += MPI_Wtime() - start;
+                images += filtered;
+            }
 
-            // Save image
-            stbi_write_jpg(output, width, height, 1, filtered_img, width);
+            free(owners);
+        } else if (options.distribution == DISTRIBUTE_COUNTER)
+        {
+            // Every rank claims the next image from a shared counter
+            filter_images_counter(argc, argv, win_size, sim_win_size, sigma, &options, rank, &busy, &images);
+        } else if (options.distribution == DISTRIBUTE_DYNAMIC)
+        {
+            // Rank 0 hands out the images on demand
+            filter_images_dynamic(argc, argv, win_size, sim_win_size, sigma, &options, rank, total_ranks, &busy, &images);
+        } else
+        {
+            // Apply the filter to all images
+            for (int i = 4 + rank; i < argc; i += total_ranks)
+            {
+                double start = MPI_Wtime();
 
-            // Free memory
-            stbi_image_free(rgb_img);
-            stbi_image_free(gray_img);
-            stbi_image_free(filtered_img);
+                int filtered = filter_image(argv[i], i - 4, win_size, sim_win_size, sigma, &options);
+                busy += MPI_Wtime() - start;
+                images += filtered;
+            }
         }
 
+        print_busy_summary(busy, images, rank, total_ranks);
+
         // Terminate MPI execution environment
         MPI_Finalize();
     }